@@ -0,0 +1,417 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Where the data path runs, so that runs are repeatable:  with
+ * --cpus list each source or sink loop (each --conns connection, each
+ * -F child) pins itself in stats_start() to the next CPU of "list",
+ * round robin, and so does each --cps thread.  A thread is pinned once:
+ * --cc-compare's runs, one after the other, all stay on the first CPU.  --irq-cpus ifname picks
+ * the list instead:  the CPUs on the NUMA node of the interface's device
+ * (or of the CPUs that take its interrupts), leaving out those that take
+ * them if any are left, so that softirq processing doesn't compete with
+ * the loops.
+ * --numa also binds each pinned thread's memory (and, from the start,
+ * the main thread's, which allocates the shared buffers) to the node of
+ * its CPU, with set_mempolicy(MPOL_BIND).
+ *
+ * All of it comes from sysfs and /proc:  /sys/devices/system/node for
+ * which CPUs are on which node, /sys/class/net/ifname/device for the
+ * device's node and MSI interrupts (else the lines of /proc/interrupts
+ * naming the interface), and /proc/irq/n for their CPUs.  What was
+ * chosen, and where each thread ended up, goes in the summary.
+ */
+
+#define	_GNU_SOURCE		/* CPU_SET(), sched_setaffinity() */
+#include "sock.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef	HAVE_LINUX_MEMPOLICY_H
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef	CPU_SET
+
+#define	MAXNODES	1024
+
+struct placement {
+	int	cpu;		/* asked for */
+	int	oncpu;		/* sched_getcpu() once there */
+	int	node;
+};
+
+static int		*cpus;		/* to pin to, in order */
+static int		 ncpus;
+static int		 cpunode[CPU_SETSIZE];	/* -1 if not known */
+static int		 nextcpu;	/* cpus[] index of the next thread */
+static struct placement	*placed;
+static int		 nplaced;
+static __thread int	 pinned;	/* this thread, already */
+static pthread_mutex_t	 placed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Parse a list like "0-3,8,10-11" into "set".  Returns the number of
+ * CPUs, or -1 if it isn't a list.
+ */
+static int
+parse_cpulist(const char *s, cpu_set_t *set)
+{
+	char	*end;
+	long	 lo, hi;
+
+	CPU_ZERO(set);
+	while (*s != 0 && *s != '\n') {
+		lo = hi = strtol(s, &end, 10);
+		if (end == s)
+			return(-1);
+		if (*end == '-') {
+			s = end + 1;
+			hi = strtol(s, &end, 10);
+			if (end == s)
+				return(-1);
+		}
+		if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+			return(-1);
+		for ( ; lo <= hi; lo++)
+			CPU_SET(lo, set);
+		s = end;
+		if (*s == ',')
+			s++;
+		else if (*s != 0 && *s != '\n')
+			return(-1);
+	}
+	return(CPU_COUNT(set));
+}
+
+/*
+ * Read a cpulist file into "set".  Returns -1 if there is no such file.
+ */
+static int
+read_cpulist(const char *path, cpu_set_t *set)
+{
+	FILE	*fp;
+	char	 line[4096];
+	int	 n;
+
+	CPU_ZERO(set);
+	if ( (fp = fopen(path, "r")) == NULL)
+		return(-1);
+	n = -1;
+	if (fgets(line, sizeof(line), fp) != NULL)
+		n = parse_cpulist(line, set);
+	fclose(fp);
+	return(n);
+}
+
+/*
+ * Format "set" as a cpulist into "buf".
+ */
+static char *
+cpulist_str(const cpu_set_t *set, char *buf, size_t len)
+{
+	int	i, j, n;
+
+	n = 0;
+	buf[0] = 0;
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (!CPU_ISSET(i, set))
+			continue;
+		for (j = i; j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, set); j++)
+			;
+		if ((size_t) n >= len)
+			break;
+		n += snprintf(buf + n, len - n, j > i ? "%s%d-%d" : "%s%d",
+		    n ? "," : "", i, j);
+		i = j;
+	}
+	return(buf);
+}
+
+/*
+ * Fill in cpunode[] from /sys/devices/system/node/node*\/cpulist.
+ */
+static void
+read_nodes(void)
+{
+	DIR		*dp;
+	struct dirent	*de;
+	cpu_set_t	 set;
+	char		 path[PATH_MAX];
+	int		 i, node;
+
+	for (i = 0; i < CPU_SETSIZE; i++)
+		cpunode[i] = -1;
+	if ( (dp = opendir("/sys/devices/system/node")) == NULL)
+		return;
+	while ( (de = readdir(dp)) != NULL) {
+		if (strncmp(de->d_name, "node", 4) != 0 ||
+		    !isdigit((u_char) de->d_name[4]))
+			continue;
+		node = atoi(de->d_name + 4);
+		snprintf(path, sizeof(path),
+		    "/sys/devices/system/node/%s/cpulist", de->d_name);
+		if (read_cpulist(path, &set) <= 0)
+			continue;
+		for (i = 0; i < CPU_SETSIZE; i++)
+			if (CPU_ISSET(i, &set))
+				cpunode[i] = node;
+	}
+	closedir(dp);
+}
+
+/*
+ * Add the CPUs that take interrupt "irq" to "set".
+ */
+static void
+irq_affinity(const char *irq, cpu_set_t *set)
+{
+	cpu_set_t	cs;
+	char		path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/proc/irq/%s/effective_affinity_list",
+	    irq);
+	if (read_cpulist(path, &cs) <= 0) {
+		snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list",
+		    irq);
+		if (read_cpulist(path, &cs) <= 0)
+			return;
+	}
+	CPU_OR(set, set, &cs);
+}
+
+/*
+ * The CPUs that take the interrupts of interface "ifname", into "set":
+ * its device's MSI interrupts, else those /proc/interrupts names it in.
+ * Returns the number of interrupts.
+ */
+static int
+irq_cpus(const char *ifname, cpu_set_t *set)
+{
+	DIR		*dp;
+	struct dirent	*de;
+	FILE		*fp;
+	char		 path[PATH_MAX], line[4096], *p;
+	int		 nirqs;
+
+	CPU_ZERO(set);
+	nirqs = 0;
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs",
+	    ifname);
+	if ( (dp = opendir(path)) != NULL) {
+		while ( (de = readdir(dp)) != NULL)
+			if (isdigit((u_char) de->d_name[0])) {
+				irq_affinity(de->d_name, set);
+				nirqs++;
+			}
+		closedir(dp);
+	}
+	if (nirqs > 0 || (fp = fopen("/proc/interrupts", "r")) == NULL)
+		return(nirqs);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		for (p = line; *p == ' '; p++)
+			;
+		if (!isdigit((u_char) *p) || strstr(line, ifname) == NULL)
+			continue;
+		p[strspn(p, "0123456789")] = 0;
+		irq_affinity(p, set);
+		nirqs++;
+	}
+	fclose(fp);
+	return(nirqs);
+}
+
+/*
+ * --irq-cpus:  the CPUs on the interface's node, into "set".
+ */
+static void
+pick_irq_cpus(const char *ifname, cpu_set_t *set)
+{
+	cpu_set_t	 allowed, irqset, nodeset, rest;
+	FILE		*fp;
+	char		 path[PATH_MAX], b1[256], b2[256];
+	int		 i, node, nirqs;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s", ifname);
+	if (access(path, F_OK) < 0)
+		err_quit("--irq-cpus: no interface %s", ifname);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+		err_sys("sched_getaffinity error");
+	nirqs = irq_cpus(ifname, &irqset);
+
+	node = -1;
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node",
+	    ifname);
+	if ( (fp = fopen(path, "r")) != NULL) {
+		if (fgets(b1, sizeof(b1), fp) != NULL)
+			node = atoi(b1);
+		fclose(fp);
+	}
+	for (i = 0; node < 0 && i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &irqset))
+			node = cpunode[i];	/* the first IRQ CPU's */
+
+	CPU_ZERO(&nodeset);
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (node < 0 || cpunode[i] == node)
+			CPU_SET(i, &nodeset);
+	CPU_AND(set, &nodeset, &allowed);
+	CPU_XOR(&rest, set, &irqset);
+	CPU_AND(&rest, &rest, set);		/* set minus irqset */
+	if (CPU_COUNT(&rest) > 0)
+		*set = rest;
+	else if (CPU_COUNT(set) == 0)
+		*set = allowed;
+
+	if (node >= 0)
+		snprintf(path, sizeof(path), "node %d", node);
+	else
+		snprintf(path, sizeof(path), "no NUMA node");
+	fprintf(stderr, "%s: %s, %d IRQs on cpus %s; using cpus %s\n",
+	    ifname, path, nirqs,
+	    nirqs ? cpulist_str(&irqset, b1, sizeof(b1)) : "?",
+	    cpulist_str(set, b2, sizeof(b2)));
+}
+
+/*
+ * Bind this thread's memory to "node", for --numa.
+ */
+static void
+bind_node(int node)
+{
+#ifdef	HAVE_LINUX_MEMPOLICY_H
+	unsigned long	mask[MAXNODES / (8 * sizeof(unsigned long))];
+
+	if (node < 0 || node >= MAXNODES)
+		return;			/* not known */
+	bzero(mask, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] |=
+	    1UL << (node % (8 * sizeof(unsigned long)));
+	if (syscall(__NR_set_mempolicy, MPOL_BIND, mask, MAXNODES) < 0)
+		err_sys("set_mempolicy error");
+#endif
+}
+
+/*
+ * Work out the CPUs from --cpus or --irq-cpus, before any socket or
+ * buffer is allocated.
+ */
+void
+affinity_init(void)
+{
+	cpu_set_t	set;
+	int		i;
+
+#ifndef	HAVE_LINUX_MEMPOLICY_H
+	if (numabind)
+		err_quit("--numa not supported by host");
+#endif
+	read_nodes();
+	if (cpulist != NULL) {
+		if (parse_cpulist(cpulist, &set) <= 0)
+			err_quit("invalid --cpus list: %s", cpulist);
+	} else
+		pick_irq_cpus(irqif, &set);
+
+	if ( (cpus = calloc(CPU_COUNT(&set), sizeof(int))) == NULL)
+		err_sys("calloc error for --cpus");
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &set))
+			cpus[ncpus++] = i;
+	if (numabind)
+		bind_node(cpunode[cpus[0]]);	/* for the shared buffers */
+}
+
+/*
+ * Pin the calling thread to the next CPU; called as each source or sink
+ * loop starts, and by each --cps thread.
+ */
+void
+affinity_thread(void)
+{
+	struct placement	p;
+	cpu_set_t		set;
+
+	if (cpus == NULL || pinned)
+		return;
+	pinned = 1;
+	p.cpu = cpus[__atomic_fetch_add(&nextcpu, 1, __ATOMIC_RELAXED) %
+	    ncpus];
+	p.node = cpunode[p.cpu];
+	CPU_ZERO(&set);
+	CPU_SET(p.cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		err_sys("can't pin to cpu %d", p.cpu);
+	if (numabind)
+		bind_node(p.node);
+	p.oncpu = sched_getcpu();
+
+	pthread_mutex_lock(&placed_lock);
+	if ( (placed = realloc(placed,
+	    (nplaced + 1) * sizeof(struct placement))) == NULL)
+		err_sys("realloc error");
+	placed[nplaced++] = p;
+	pthread_mutex_unlock(&placed_lock);
+}
+
+/*
+ * -F:  the parent moves on to the next CPU for the next child.
+ */
+void
+affinity_fork(void)
+{
+	if (cpus != NULL)
+		nextcpu++;
+}
+
+/*
+ * Where the threads went.
+ */
+void
+affinity_report(void)
+{
+	int	i;
+
+	pthread_mutex_lock(&placed_lock);
+	if (nplaced > 0) {
+		fprintf(stderr, "placement (%s):",
+		    numabind ? "memory on the CPU's node" : "memory not bound");
+		for (i = 0; i < nplaced; i++) {
+			if (i > 0 && i % 6 == 0)
+				fprintf(stderr, "\n ");
+			fprintf(stderr, " cpu%d", placed[i].cpu);
+			if (placed[i].node >= 0)
+				fprintf(stderr, "/node%d", placed[i].node);
+			if (placed[i].oncpu != placed[i].cpu)
+				fprintf(stderr, " (on cpu%d)", placed[i].oncpu);
+		}
+		fprintf(stderr, "\n");
+	}
+	pthread_mutex_unlock(&placed_lock);
+}
+
+#else	/* CPU_SET */
+
+void
+affinity_init(void)
+{
+	err_quit("--cpus and --irq-cpus not supported by host");
+}
+
+void
+affinity_thread(void)
+{
+}
+
+void
+affinity_fork(void)
+{
+}
+
+void
+affinity_report(void)
+{
+}
+
+#endif	/* CPU_SET */
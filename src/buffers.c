@@ -26,6 +26,13 @@ void buffers(int sockfd)
 		if ( (wbuf = malloc(writelen)) == NULL)
 			err_sys("malloc error for write buffer");
 	}
+
+	/* Separate header buffer for writev()/readv(), with --iov-hdr. */
+	if (iovhdrlen && hbuf == NULL) {
+		if ( (hbuf = malloc(iovhdrlen)) == NULL)
+			err_sys("malloc error for header buffer");
+		pattern(hbuf, iovhdrlen);
+	}
   
 	/* Set the socket send and receive buffer sizes (if specified).
 	   The receive buffer size is tied to TCP's advertised window. */
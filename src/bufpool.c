@@ -0,0 +1,205 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Shared pool of fixed-size read buffers.
+ *
+ * rbuf is a single process-global buffer, which is fine for one connection.
+ * With --bufpool each sink loop instead waits, holding no buffer, until
+ * its connection has something to read, borrows a buffer from this pool
+ * for that read and hands it back straight after, so that idle
+ * connections hold none.  With the sink server's --conns threads memory
+ * is then sized by the number of connections moving data at once (the
+ * high-water mark), not by the number open.
+ *
+ * Buffers are carved out of slabs of BUFPOOL_SLAB buffers, which are
+ * malloc'ed lazily as demand grows and never freed.  Each thread keeps a
+ * small cache of free buffers so that the global lock is only taken to
+ * refill or drain that cache in batches.
+ *
+ * The write side needs no pool:  senders only ever read from wbuf, so the
+ * single pattern-filled wbuf is shared by all of them.
+ */
+
+#include <pthread.h>
+#include <poll.h>
+#include "sock.h"
+
+#define	BUFPOOL_SLAB	64	/* #buffers allocated at a time */
+#define	BUFPOOL_CACHE	16	/* max #free buffers cached per thread */
+
+/* A free buffer holds the link to the next free buffer. */
+struct bufpool_free {
+	struct bufpool_free	*next;
+};
+
+static pthread_mutex_t		pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bufpool_free     *pool_freelist;
+static size_t			pool_bufsize;
+static int			pool_max;	/* 0 = no limit */
+static int			pool_nalloc;	/* #buffers carved so far */
+static int			pool_nslabs;
+static volatile int		pool_inuse;	/* #buffers borrowed now */
+static volatile int		pool_hiwat;	/* max of pool_inuse */
+
+static __thread struct bufpool_free	*cache_list;
+static __thread int			 cache_cnt;
+
+/*
+ * Set the size of each buffer and the maximum number of buffers the pool
+ * may hold (0 for no limit).  Nothing is allocated until the first
+ * bufpool_get().
+ */
+void
+bufpool_init(size_t bufsize, int maxbufs)
+{
+	pthread_mutex_lock(&pool_lock);
+	if (pool_bufsize == 0) {
+		/* must be able to hold the free list link */
+		pool_bufsize = max(bufsize, sizeof(struct bufpool_free));
+		pool_max = maxbufs;
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Allocate another slab and put its buffers on the global free list.
+ * Called with pool_lock held.  Returns 0 if the pool is at its limit.
+ */
+static int
+bufpool_grow(void)
+{
+	char	*slab;
+	int	 i, n;
+
+	n = BUFPOOL_SLAB;
+	if (pool_max != 0) {
+		if (pool_nalloc >= pool_max)
+			return(0);
+		n = min(n, pool_max - pool_nalloc);
+	}
+
+	if ( (slab = malloc(n * pool_bufsize)) == NULL)
+		err_sys("malloc error for buffer pool");
+
+	for (i = 0; i < n; i++) {
+		struct bufpool_free *bp;
+
+		bp = (struct bufpool_free *) (slab + i * pool_bufsize);
+		bp->next = pool_freelist;
+		pool_freelist = bp;
+	}
+	pool_nalloc += n;
+	pool_nslabs++;
+
+	return(n);
+}
+
+/*
+ * Borrow a buffer of the size given to bufpool_init().
+ */
+char *
+bufpool_get(void)
+{
+	struct bufpool_free	*bp;
+	int			 inuse, hiwat;
+
+	if (cache_cnt == 0) {
+		/* refill half of the per-thread cache in one go */
+		pthread_mutex_lock(&pool_lock);
+		while (cache_cnt < BUFPOOL_CACHE / 2) {
+			if (pool_freelist == NULL && bufpool_grow() == 0)
+				break;
+			bp = pool_freelist;
+			pool_freelist = bp->next;
+			bp->next = cache_list;
+			cache_list = bp;
+			cache_cnt++;
+		}
+		pthread_mutex_unlock(&pool_lock);
+
+		if (cache_cnt == 0)
+			err_quit("buffer pool exhausted (%d buffers)",
+			    pool_max);
+	}
+
+	bp = cache_list;
+	cache_list = bp->next;
+	cache_cnt--;
+
+	inuse = __sync_add_and_fetch(&pool_inuse, 1);
+	while (inuse > (hiwat = pool_hiwat)) {
+		if (__sync_bool_compare_and_swap(&pool_hiwat, hiwat, inuse))
+			break;
+	}
+
+	return((char *) bp);
+}
+
+/*
+ * Return a buffer obtained from bufpool_get().
+ */
+void
+bufpool_put(char *buf)
+{
+	struct bufpool_free	*bp;
+
+	__sync_sub_and_fetch(&pool_inuse, 1);
+
+	if (cache_cnt == BUFPOOL_CACHE) {
+		/* drain half of the per-thread cache in one go */
+		pthread_mutex_lock(&pool_lock);
+		while (cache_cnt > BUFPOOL_CACHE / 2) {
+			bp = cache_list;
+			cache_list = bp->next;
+			cache_cnt--;
+			bp->next = pool_freelist;
+			pool_freelist = bp;
+		}
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	bp = (struct bufpool_free *) buf;
+	bp->next = cache_list;
+	cache_list = bp;
+	cache_cnt++;
+}
+
+/*
+ * Print the pool size and its high-water mark, which is what memory for
+ * a large number of connections has to be sized for.
+ */
+void
+bufpool_report(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	fprintf(stderr, "bufpool: %d buffers of %lu bytes in %d slabs, "
+	    "high-water mark %d buffers (%lu bytes)\n",
+	    pool_nalloc, (unsigned long) pool_bufsize, pool_nslabs,
+	    pool_hiwat, (unsigned long) pool_hiwat * pool_bufsize);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Get a buffer to read "fd" into:  the global rbuf, or with --bufpool one
+ * from the pool, once "fd" has something to read.
+ */
+char *
+rbuf_get(int fd)
+{
+	struct pollfd	pfd;
+
+	if (bufpoolmax < 0)
+		return(rbuf);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, -1) < 0)	/* POLLHUP etc. left to the read */
+		if (errno != EINTR)
+			err_sys("poll error");
+	return(bufpool_get());
+}
+
+void
+rbuf_put(char *buf)
+{
+	if (buf != rbuf)
+		bufpool_put(buf);
+}
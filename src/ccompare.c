@@ -0,0 +1,144 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Congestion control comparison, with --cc-compare a,b,...  The TCP
+ * source workload (-n, -w, etc.) is run once per algorithm, one after
+ * the other, each over a new connection with TCP_CONGESTION set to that
+ * algorithm.  At the end of each run TCP_INFO is read, and a table of
+ * throughput, retransmits and RTT is printed side by side.  With --cpus
+ * all of the runs are on the same CPU.
+ *
+ * The sink has to accept a connection per run, so give it -F.
+ * Algorithms the host doesn't have (e.g. the module isn't loaded) are
+ * reported and skipped.
+ */
+
+#include "sock.h"
+
+struct ccrun {
+	char		*name;		/* algorithm */
+	int		 skipped;	/* not available on this host */
+	int		 haveinfo;	/* TCP_INFO was read */
+	struct sockstats stats;		/* bytes written and time taken */
+	struct tcpstat	 ts;		/* TCP_INFO at the end of the run */
+};
+
+static struct ccrun	*runs;
+static int		 nruns;
+static struct ccrun	*currun;	/* run in progress */
+
+/*
+ * Can TCP_CONGESTION be set to "name" on this host?  Try it on a
+ * scratch socket, so that a missing algorithm doesn't end the whole
+ * comparison.
+ */
+static int
+cc_available(char *name)
+{
+#ifdef	TCP_CONGESTION
+	int	fd, rc;
+
+	if ( (fd = socket(af_46, SOCK_STREAM, 0)) < 0)
+		err_sys("socket() error");
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, strlen(name));
+	if (rc < 0)
+		fprintf(stderr, "warning: %s: %s, skipped\n",
+		    name, strerror(errno));
+	close(fd);
+	return(rc == 0);
+#else
+	err_quit("TCP_CONGESTION not supported by host");
+	return(0);
+#endif
+}
+
+/*
+ * Called by source_tcp() after its last write, before close():  the run
+ * ends once all of it has been acknowledged, so that the Mbit/s column is
+ * delivered throughput rather than the time to fill the send buffer.
+ */
+void
+cc_sample(int sockfd)
+{
+	if (currun == NULL)
+		return;
+	currun->stats = stats;
+	if (tcpinfo_drain(sockfd, &currun->ts) == 0) {
+		currun->haveinfo = 1;
+		if (currun->ts.notsent_bytes != 0 || currun->ts.unacked != 0)
+			fprintf(stderr, "warning: %s: not all acknowledged\n",
+			    currun->name);
+	}
+	/* delivered, not just handed to the send buffer */
+	currun->stats.end_ns = time_ns();
+}
+
+static void
+cc_table(void)
+{
+	struct ccrun	*r;
+	double		 secs;
+	int		 i;
+
+	printf("%-12s %10s %10s %8s %10s %10s %8s\n", "algorithm",
+	    "Mbit/s", "bytes", "retrans", "rtt ms", "rttvar ms", "cwnd");
+	for (i = 0; i < nruns; i++) {
+		r = &runs[i];
+		printf("%-12s ", r->name);
+		if (r->skipped) {
+			printf("%10s\n", "n/a");
+			continue;
+		}
+		secs = (r->stats.end_ns - r->stats.start_ns) / 1e9;
+		printf("%10.1f %10llu ",
+		    secs > 0 ? r->stats.tx_bytes * 8 / secs / 1e6 : 0.0,
+		    (unsigned long long) r->stats.tx_bytes);
+		if (r->haveinfo)
+			printf("%8u %10.3f %10.3f %8u\n", r->ts.retrans,
+			    r->ts.rtt_us / 1e3, r->ts.rttvar_us / 1e3,
+			    r->ts.snd_cwnd);
+		else
+			printf("%8s %10s %10s %8s\n", "-", "-", "-", "-");
+	}
+	fflush(stdout);
+}
+
+/*
+ * Run the source once for each algorithm in cclist, then print the table.
+ */
+void
+cc_compare(char *host, char *port)
+{
+	char	*ptr;
+	int	 fd;
+
+	for (ptr = strtok(cclist, ","); ptr != NULL;
+	    ptr = strtok(NULL, ",")) {
+		if ( (runs = realloc(runs,
+		    (nruns + 1) * sizeof(struct ccrun))) == NULL)
+			err_sys("realloc error for --cc-compare");
+		bzero(&runs[nruns], sizeof(struct ccrun));
+		runs[nruns++].name = ptr;
+	}
+	if (nruns == 0)
+		err_quit("invalid --cc-compare option");
+
+	affinity_thread();		/* --cpus, once for all the runs */
+	for (currun = runs; currun < &runs[nruns]; currun++) {
+		if (!cc_available(currun->name)) {
+			currun->skipped = 1;
+			continue;
+		}
+		if (verbose)
+			fprintf(stderr, "run with TCP_CONGESTION = %s\n",
+			    currun->name);
+
+		congestion = currun->name;	/* sockopts() sets it */
+		bzero(&stats, sizeof(stats));
+		fd = cliopen(host, port);
+		source_tcp(fd);
+	}
+	currun = NULL;
+
+	cc_table();
+	affinity_report();		/* with --cpus or --irq-cpus */
+}
@@ -9,6 +9,9 @@
  */
 
 #include "sock.h"
+#include "probes.h"
+#include <fcntl.h>
+#include <poll.h>
 
 /*
  * Try to convert the host name as an IPv4 dotted-decimal number
@@ -70,15 +73,97 @@ int convert_host_name(char *host)
 	return (0);
 }
 
-int cliopen(char *host, char *port)
+#define	MAXDESTS	16		/* addresses kept for a host name */
+
+static int	sock_type;
+static int	sock_prot;
+
+static struct sockaddr_storage	dests[MAXDESTS];	/* cli_resolve() */
+static socklen_t		destlen[MAXDESTS];
+static int			ndests;
+static unsigned int		nextdest;	/* for round-robin */
+static char			*resolved;	/* "host port" of dests[] */
+
+/*
+ * Printable form of the address in "sa".
+ */
+static char *cli_ntop(struct sockaddr *sa, char *buf, socklen_t len)
+{
+	if (sa->sa_family == AF_INET)
+		inet_ntop(AF_INET, &((struct sockaddr_in *) sa)->sin_addr,
+		    buf, len);
+	else
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *) sa)->sin6_addr,
+		    buf, len);
+	return(buf);
+}
+
+/*
+ * Look up "host", for "family" (AF_UNSPEC for both), into dests[].
+ */
+static void cli_lookup(char *host, int family)
+{
+#ifdef	HAVE_ADDRINFO_PROTO
+	struct addrinfo		hints, *res, *ai;
+	int			rc, dropped;
+
+	bzero(&hints, sizeof(hints));
+	hints.ai_family = family;
+	hints.ai_socktype = sock_type;
+	if ( (rc = getaddrinfo(host, NULL, &hints, &res)) != 0)
+		err_quit("invalid hostname: %s (%s)", host, gai_strerror(rc));
+	dropped = 0;
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+			continue;
+		if (ndests == MAXDESTS) {
+			dropped++;
+			continue;
+		}
+		memcpy(&dests[ndests], ai->ai_addr, ai->ai_addrlen);
+		destlen[ndests++] = ai->ai_addrlen;
+	}
+	freeaddrinfo(res);
+	if (dropped)
+		fprintf(stderr, "warning: %s has %d addresses, using the "
+		    "first %d\n", host, ndests + dropped, MAXDESTS);
+	if (ndests == 0)
+		err_quit("no IPv4 or IPv6 address for %s", host);
+#else
+	/*
+	 * First try to convert the host name as an IPv4 dotted-decimal number
+	 * or an IPv6 address.  Only if that fails do we try to convert the
+	 * host name as a host name string.
+	 */
+	if (convert_host_address(host) != 1) {
+		if (convert_host_name(host) != 1) {
+			err_quit("invalid hostname: %s", host);
+		}
+	}
+	if (AF_INET == af_46) {
+		memcpy(&dests[0], &servaddr4, sizeof(servaddr4));
+		destlen[0] = sizeof(servaddr4);
+	} else {
+		memcpy(&dests[0], &servaddr6, sizeof(servaddr6));
+		destlen[0] = sizeof(servaddr6);
+	}
+	ndests = 1;
+#endif
+}
+
+/*
+ * Resolve "host" and "port" once, into dests[], and servaddr4/servaddr6
+ * for the code that uses them directly.  With getaddrinfo() a name can
+ * give several addresses; cli_servaddr() hands them out in turn.  With
+ * --happy-eyeballs both IPv4 and IPv6 addresses are kept.
+ */
+void cli_resolve(char *host, char *port)
 {
-	int			fd, i, on;
-	char			*protocol;
+	int			i, n;
+	char			*protocol, *key;
 	char			inaddr_buf[INET6_ADDRSTRLEN];
 	struct servent		*sp;
-	socklen_t		socklen;
-	int			sock_type;
-	int			sock_prot;
+	uint16_t		nport;
 
 	switch (l4_prot) {
 	case L4_PROT_UDP:
@@ -98,6 +183,18 @@ int cliopen(char *host, char *port)
 		sock_prot = 0;
 		break;
 	}
+
+	/* already done, e.g. for the next --cc-compare run */
+	n = strlen(host) + strlen(port) + 2;
+	if ( (key = malloc(n)) == NULL)
+		err_sys("malloc error");
+	snprintf(key, n, "%s %s", host, port);
+	if (resolved != NULL && strcmp(resolved, key) == 0) {
+		free(key);
+		return;
+	}
+	free(resolved);
+	resolved = key;
   
 	/* initialize socket address structure */
 	bzero(&servaddr4, sizeof(servaddr4));
@@ -111,27 +208,71 @@ int cliopen(char *host, char *port)
 		if ( (sp = getservbyname(port, protocol)) == NULL)
 			err_quit("getservbyname() error for: %s/%s",
 			    port, protocol);
-		servaddr4.sin_port  = sp->s_port;
-		servaddr6.sin6_port = sp->s_port;
+		nport = sp->s_port;
 	} else {
-		servaddr4.sin_port  = htons(i);
-		servaddr6.sin6_port = htons(i);
+		nport = htons(i);
 	}
-  
-	/*
-	 * First try to convert the host name as an IPv4 dotted-decimal number
-	 * or an IPv6 address.  Only if that fails do we try to convert the
-	 * host name as a host name string.
-	 */
-	if (convert_host_address(host) != 1) {
-		if (convert_host_name(host) != 1) {
-			err_quit("invalid hostname: %s", host);
+	servaddr4.sin_port  = nport;
+	servaddr6.sin6_port = nport;
+
+	ndests = 0;
+	nextdest = 0;
+	cli_lookup(host, happyeyeballs ? AF_UNSPEC : af_46);
+
+	for (i = 0; i < ndests; i++) {
+		if (dests[i].ss_family == AF_INET) {
+			((struct sockaddr_in *) &dests[i])->sin_port = nport;
+		} else {
+			((struct sockaddr_in6 *) &dests[i])->sin6_port = nport;
+			((struct sockaddr_in6 *) &dests[i])->sin6_len =
+			    sizeof(struct sockaddr_in6);
 		}
+		if (verbose && ndests > 1)
+			fprintf(stderr, "%s address %d of %d: %s\n", host,
+			    i + 1, ndests, cli_ntop((struct sockaddr *) &dests[i],
+			    inaddr_buf, sizeof(inaddr_buf)));
 	}
 
-	if ( (fd = socket(af_46, sock_type, sock_prot)) < 0) {
-		err_sys("socket() error");
+	/* the first of each family, for servaddr4/servaddr6 users */
+	for (i = ndests - 1; i >= 0; i--) {
+		if (dests[i].ss_family == AF_INET)
+			memcpy(&servaddr4, &dests[i], sizeof(servaddr4));
+		else
+			memcpy(&servaddr6, &dests[i], sizeof(servaddr6));
 	}
+	servaddr6.sin6_len = sizeof(struct sockaddr_in6);
+}
+
+/*
+ * The next of the server's addresses found by cli_resolve(), in turn.
+ */
+struct sockaddr *cli_servaddr(socklen_t *lenp)
+{
+	int	i;
+
+	i = __sync_fetch_and_add(&nextdest, 1) % ndests;
+	*lenp = destlen[i];
+	return((struct sockaddr *) &dests[i]);
+}
+
+/*
+ * Create a socket, bind it if asked, and set the options that have to be
+ * set before connect().  Returns -1 with errno set if socket() or bind()
+ * fails, e.g. EMFILE, so that --conns and --cps can count it.
+ *
+ * The first call allocates the shared buffers (buffers()), and with -v
+ * buffers() and sockopts() print what they set, so --cps makes a first
+ * call before starting its threads; later calls from them only set
+ * options on the new socket, though with -v they print it again.
+ */
+int cli_socket(void)
+{
+	int			fd, on;
+	struct sockaddr_in	addr4;
+	struct sockaddr_in6	addr6;
+
+	if ( (fd = socket(af_46, sock_type, sock_prot)) < 0)
+		return(-1);
 	if (reuseaddr) {
 		on = 1;
 		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on)) < 0)
@@ -155,38 +296,45 @@ int cliopen(char *host, char *port)
 	 * (and port) using -l option.  Allow localip[] to be set but bindport
 	 * to be 0.
 	 */
-	if (bindport != 0 || localip[0] != 0 || l4_prot == L4_PROT_UDP) {
+	if (localaddrs != NULL) {
+		if (srcpool_bind(fd) < 0)	/* --local-addrs */
+			goto bindfail;
+	} else if (bindport != 0 || localip[0] != 0 || l4_prot == L4_PROT_UDP) {
 		if (af_46 == AF_INET) {
-			bzero(&cliaddr4, sizeof(cliaddr4));
-			cliaddr4.sin_family      = AF_INET;
+			bzero(&addr4, sizeof(addr4));
+			addr4.sin_family      = AF_INET;
 			/* can be 0 */
-			cliaddr4.sin_port        = htons(bindport);
+			addr4.sin_port        = htons(bindport);
 			if (localip[0] != 0) {
-				if (inet_aton(localip, &cliaddr4.sin_addr) == 0)
+				if (inet_aton(localip, &addr4.sin_addr) == 0)
 					err_quit("invalid IP address: %s",
 					    localip);
 			} else {
 				/* wildcard */
-				cliaddr4.sin_addr.s_addr = htonl(INADDR_ANY);
-			}
-			if (bind(fd, (struct sockaddr *) &cliaddr4,
-				    sizeof(cliaddr4)) < 0) {
-				err_sys("bind() error");
+				addr4.sin_addr.s_addr = htonl(INADDR_ANY);
 			}
+			if (bind(fd, (struct sockaddr *) &addr4,
+				    sizeof(addr4)) < 0)
+				goto bindfail;
 		} else {
-			bzero(&cliaddr6, sizeof(cliaddr6));
-			cliaddr6.sin6_len    = sizeof(struct sockaddr_in6);
-			cliaddr6.sin6_family = AF_INET6;
+			bzero(&addr6, sizeof(addr6));
+			addr6.sin6_len    = sizeof(struct sockaddr_in6);
+			addr6.sin6_family = AF_INET6;
 			/* can be 0 */
-			cliaddr6.sin6_port   = htons(bindport);
+			addr6.sin6_port   = htons(bindport);
 
-			/* Note:  localip not implemented for IPv6 */
-			cliaddr6.sin6_addr = in6addr_any;
-
-			if (bind(fd, (struct sockaddr *) &cliaddr6,
-				    sizeof(cliaddr6)) < 0) {
-				err_sys("bind() error");
+			if (localip[0] != 0) {
+				if (inet_pton(AF_INET6, localip,
+				    &addr6.sin6_addr) != 1)
+					err_quit("invalid IPv6 address: %s",
+					    localip);
+			} else {
+				/* wildcard */
+				addr6.sin6_addr = in6addr_any;
 			}
+			if (bind(fd, (struct sockaddr *) &addr6,
+				    sizeof(addr6)) < 0)
+				goto bindfail;
 		}
 	}
 
@@ -200,33 +348,69 @@ int cliopen(char *host, char *port)
 	
 	buffers(fd);
 	sockopts(fd, 0);	/* may also want to set SO_DEBUG */
-	
-	/*
-	 * Connect to the server.  Required for TCP, optional for UDP.
-	 * Fixme:  Don't know about SCTP
-	 */
-	if (l4_prot == L4_PROT_TCP || connectudp) {
-		for ( ; ; ) {
-			if (AF_INET == af_46) {
-				if (connect(fd, (struct sockaddr *) &servaddr4,
-				    sizeof(servaddr4)) == 0)
-				break;		/* all OK */
-			} else {
-				servaddr6.sin6_len =
-				    sizeof(struct sockaddr_in6);
-				servaddr6.sin6_family = AF_INET6;
-				if (connect(fd, (struct sockaddr *) &servaddr6,
-				    sizeof(servaddr6)) == 0)
-				break;		/* all OK */
-			}
-			if (errno == EINTR)	/* can happen with SIGIO */
-				continue;
-			if (errno == EISCONN)	/* can happen with SIGIO */
-				break;
-			err_sys("connect() error");
-		}
+
+	return(fd);
+
+bindfail:
+	on = errno;
+	close(fd);
+	errno = on;
+	return(-1);
+}
+
+/*
+ * Blocking connect() of "fd" to "sa".  A connect() interrupted by a
+ * signal (can happen with SIGIO) carries on regardless, and calling it
+ * again gives EALREADY until it's done, so instead wait for the socket
+ * to be writable and take the outcome from SO_ERROR.
+ */
+static void cli_connect_wait(int fd, struct sockaddr *sa, socklen_t salen)
+{
+	struct pollfd	pfd;
+	socklen_t	optlen;
+	int		err;
+
+	if (connect(fd, sa, salen) == 0 || errno == EISCONN)
+		return;		/* all OK */
+	if (errno != EINTR && errno != EALREADY && errno != EINPROGRESS)
+		err_sys("connect() error");
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	while (poll(&pfd, 1, -1) < 0)
+		if (errno != EINTR)
+			err_sys("poll error");
+	optlen = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &optlen) < 0)
+		err_sys("getsockopt of SO_ERROR error");
+	if (err != 0) {
+		errno = err;
+		err_sys("connect() error");
 	}
-  
+}
+
+/*
+ * Connect to the server, blocking until done.
+ */
+void cli_connect(int fd)
+{
+	struct sockaddr		*sa;
+	socklen_t		salen;
+
+	sa = cli_servaddr(&salen);
+	cli_connect_wait(fd, sa, salen);
+}
+
+/*
+ * Once connected:  report the addresses if verbose, and set the
+ * options that have to be set after connect().
+ */
+void cli_connected(int fd)
+{
+	char			inaddr_buf[INET6_ADDRSTRLEN];
+	socklen_t		socklen;
+	struct sockaddr_storage	peer;
+
+	PROBE2(conn__open, fd, 0);
 	if (verbose) {
 		/* Call getsockname() to find local address bound to socket:
 		   TCP ephemeral port was assigned by connect() or bind();
@@ -242,9 +426,14 @@ int cliopen(char *host, char *port)
 			fprintf(stderr, "connected on %s.%d ",
 			    INET_NTOA(cliaddr4.sin_addr),
 			    ntohs(cliaddr4.sin_port));
+			socklen = sizeof(peer);
+			if (getpeername(fd, (struct sockaddr *) &peer,
+			    &socklen) < 0)
+				memcpy(&peer, &servaddr4, sizeof(servaddr4));
 			fprintf(stderr, "to %s.%d\n",
-			    INET_NTOA(servaddr4.sin_addr),
-			    ntohs(servaddr4.sin_port));
+			    cli_ntop((struct sockaddr *) &peer, inaddr_buf,
+			    sizeof(inaddr_buf)),
+			    ntohs(((struct sockaddr_in *) &peer)->sin_port));
 		} else {
 			socklen = sizeof(cliaddr6);
 			if (getsockname(fd,
@@ -257,15 +446,201 @@ int cliopen(char *host, char *port)
 			    inaddr_buf, sizeof(inaddr_buf));
 			fprintf(stderr, "connected on %s.%d ",
 			    inaddr_buf, ntohs(cliaddr6.sin6_port));
-			inet_ntop(AF_INET6,
-			    &servaddr6.sin6_addr.__u6_addr.__u6_addr8,
-			    inaddr_buf, sizeof(inaddr_buf));
+			socklen = sizeof(peer);
+			if (getpeername(fd, (struct sockaddr *) &peer,
+			    &socklen) < 0)
+				memcpy(&peer, &servaddr6, sizeof(servaddr6));
 			fprintf(stderr, "to %s.%d\n",
-			    inaddr_buf, ntohs(servaddr6.sin6_port));
+			    cli_ntop((struct sockaddr *) &peer, inaddr_buf,
+			    sizeof(inaddr_buf)),
+			    ntohs(((struct sockaddr_in6 *) &peer)->sin6_port));
 		}
 	}
 	
 	sockopts(fd, 1);	/* some options get set after connect() */
+}
+
+/*
+ * One of the two connects raced by cli_happy().
+ */
+struct heconn {
+	int		 af;
+	int		 fd;		/* -1 until started */
+	struct sockaddr	*sa;
+	socklen_t	 salen;
+	uint64_t	 start, done;	/* time_ns() */
+	int		 err;		/* connect() error, if done */
+};
+
+#define	HE_GRACE	1000	/* ms to let the loser finish, to time it */
+
+static void he_start(struct heconn *h)
+{
+	int	flags;
+
+	af_46 = h->af;		/* cli_socket() and sockopts() go by it */
+	if ( (h->fd = cli_socket()) < 0)
+		err_sys("socket() or bind() error");
+	if ( (flags = fcntl(h->fd, F_GETFL, 0)) < 0 ||
+	    fcntl(h->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		err_sys("fcntl error");
+	h->start = time_ns();
+	if (connect(h->fd, h->sa, h->salen) == 0)
+		h->done = time_ns();
+	else if (errno != EINPROGRESS) {
+		h->err = errno;
+		h->done = time_ns();
+	}
+}
+
+static void he_report(struct heconn *h, int head)
+{
+	fprintf(stderr, "  %s", h->af == AF_INET ? "IPv4" : "IPv6");
+	if (head)
+		fprintf(stderr, " (started after %.3f ms)", head / 1e6);
+	if (h->fd < 0 && h->done == 0)
+		fprintf(stderr, ": not tried\n");
+	else if (h->done == 0)
+		fprintf(stderr, ": not connected within %d ms of the other\n",
+		    HE_GRACE);
+	else if (h->err)
+		fprintf(stderr, ": %s\n", strerror(h->err));
+	else
+		fprintf(stderr, ": connected in %.3f ms\n",
+		    (h->done - h->start) / 1e6);
+}
+
+/*
+ * Happy Eyeballs (RFC 8305):  connect to the first IPv6 address, and if
+ * that hasn't succeeded within --happy-eyeballs ms (or has failed), to
+ * the first IPv4 address as well; the first to connect is used.  The
+ * other is given a little longer so as to report by how much it lost,
+ * then closed.  Sets af_46 to the winner's family.
+ */
+static int cli_happy(void)
+{
+	struct heconn	 he[2], *h, *win;
+	struct pollfd	 pfd[2];
+	uint64_t	 now, until;
+	socklen_t	 optlen;
+	int		 i, n, ms, flags;
+
+	bzero(he, sizeof(he));
+	he[0].af = AF_INET6;
+	he[1].af = AF_INET;
+	for (i = 0; i < 2; i++) {
+		he[i].fd = -1;
+		for (n = 0; n < ndests; n++) {
+			if (dests[n].ss_family == he[i].af) {
+				he[i].sa = (struct sockaddr *) &dests[n];
+				he[i].salen = destlen[n];
+				break;
+			}
+		}
+	}
+	if (he[0].sa == NULL || he[1].sa == NULL) {
+		/* only one family:  nothing to race */
+		h = (he[0].sa != NULL) ? &he[0] : &he[1];
+		af_46 = h->af;
+		if (verbose)
+			fprintf(stderr, "Happy Eyeballs: only %s addresses\n",
+			    af_46 == AF_INET ? "IPv4" : "IPv6");
+		if ( (i = cli_socket()) < 0)
+			err_sys("socket() or bind() error");
+		cli_connect_wait(i, h->sa, h->salen);
+		return(i);
+	}
+
+	he_start(&he[0]);
+	win = NULL;
+	until = 0;
+	for ( ; ; ) {
+		now = time_ns();
+		if (win == NULL && he[1].fd < 0 && (he[0].err != 0 ||
+		    now >= he[0].start + happyeyeballs * 1000000ULL))
+			he_start(&he[1]);	/* IPv6 failed or is slow */
+
+		for (i = 0; i < 2; i++)
+			if (win == NULL && he[i].done != 0 && he[i].err == 0)
+				win = &he[i];
+		if (win != NULL && until == 0)
+			until = win->done + HE_GRACE * 1000000ULL;
+		if (he[0].done != 0 && (he[1].fd < 0 || he[1].done != 0))
+			break;			/* all that were started are done */
+		if (until != 0 && now >= until)
+			break;			/* winner; loser too slow */
+
+		/* wait for a connect to finish, or the next deadline */
+		ms = -1;
+		if (win == NULL && he[1].fd < 0)
+			ms = (he[0].start + happyeyeballs * 1000000ULL - now)
+			    / 1000000 + 1;
+		else if (until != 0)
+			ms = (until - now) / 1000000 + 1;
+		for (i = 0; i < 2; i++) {
+			pfd[i].fd = (he[i].fd >= 0 && he[i].done == 0) ?
+			    he[i].fd : -1;
+			pfd[i].events = POLLOUT;
+			pfd[i].revents = 0;
+		}
+		if (poll(pfd, 2, ms) < 0 && errno != EINTR)
+			err_sys("poll error");
+		for (i = 0; i < 2; i++) {
+			if (pfd[i].fd < 0 || pfd[i].revents == 0)
+				continue;
+			he[i].done = time_ns();
+			optlen = sizeof(he[i].err);
+			if (getsockopt(he[i].fd, SOL_SOCKET, SO_ERROR,
+			    &he[i].err, &optlen) < 0)
+				he[i].err = errno;
+		}
+	}
+
+	if (win == NULL) {
+		errno = he[0].err;
+		err_sys("connect() error, IPv6 and IPv4");
+	}
+	for (i = 0; i < 2; i++)
+		if (&he[i] != win && he[i].fd >= 0)
+			close(he[i].fd);
+
+	fprintf(stderr, "Happy Eyeballs: %s won",
+	    win->af == AF_INET ? "IPv4" : "IPv6");
+	h = (win == &he[0]) ? &he[1] : &he[0];
+	if (h->done != 0 && h->err == 0)
+		fprintf(stderr, " by %.3f ms", (h->done - win->done) / 1e6);
+	fprintf(stderr, "\n");
+	he_report(&he[0], 0);
+	he_report(&he[1], he[1].fd >= 0 ? he[1].start - he[0].start : 0);
+
+	if ( (flags = fcntl(win->fd, F_GETFL, 0)) < 0 ||
+	    fcntl(win->fd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+		err_sys("fcntl error");
+	af_46 = win->af;
+	return(win->fd);
+}
+
+int cliopen(char *host, char *port)
+{
+	int			fd;
+
+	cli_resolve(host, port);
+	if (happyeyeballs) {
+		fd = cli_happy();	/* race IPv6 and IPv4 */
+		cli_connected(fd);
+		return(fd);
+	}
+	if ( (fd = cli_socket()) < 0)
+		err_sys("socket() or bind() error");
+	
+	/*
+	 * Connect to the server.  Required for TCP, optional for UDP.
+	 * Fixme:  Don't know about SCTP
+	 */
+	if (l4_prot == L4_PROT_TCP || connectudp)
+		cli_connect(fd);
+  
+	cli_connected(fd);
 	
 	return(fd);
 }
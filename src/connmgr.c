@@ -0,0 +1,397 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Several connections at once, with --conns n.  All "n" connects are
+ * started together on non-blocking sockets, and their completions are
+ * collected in epoll_wait() (poll() where there is no epoll), giving up
+ * on any still pending after --connect-timeout ms, so that opening them
+ * takes about one round trip rather than "n".  The socket options are
+ * set just as cliopen() does:  sockopts(fd, 0) before connect() and
+ * sockopts(fd, 1) once connected.  The time from connect() to
+ * established is kept for each connection.
+ *
+ * Each established connection is then made blocking again and handed to
+ * the usual source loop in a thread of its own.  (For UDP, "connect" just
+ * sets the peer, so each flow is a connected UDP socket.)  With --dests
+ * the connections are spread over several servers by fanout_pick().
+ * The counters in "stats" are per thread, so each connection's are
+ * collected when its thread is done, and added up for the summary.
+ *
+ * The "sink" server takes --conns too:  it accepts "n" connections and
+ * runs the sink loop on each in a thread of its own in the same way,
+ * which with --bufpool is what the pool is sized for.
+ */
+
+#include "sock.h"
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef	HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+struct conn {
+	int		 fd;
+	int		 pending;	/* connect in progress */
+	int		 err;		/* errno, if it wasn't established */
+	int		 dest;		/* --dests index */
+	uint64_t	 t_start;	/* connect() called */
+	uint64_t	 handshake;	/* connect() to established, ns */
+	pthread_t	 tid;
+	struct sockstats stats;		/* of its source or sink loop */
+	int		 havecpu;	/* the next two were read */
+	uint64_t	 cpu_user_ns;	/* its thread's, at the end */
+	uint64_t	 cpu_sys_ns;
+};
+
+static struct conn	*conns;
+static int		 npending;	/* connects still in progress */
+#ifdef	HAVE_SYS_EPOLL_H
+static int		 epfd;
+#endif
+
+/*
+ * Connect "c" finished, with error "err" (0 if established).
+ */
+static void
+conn_done(struct conn *c, int err)
+{
+	int	flags;
+
+	c->pending = 0;
+	npending--;
+#ifdef	HAVE_SYS_EPOLL_H
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL) < 0)
+		err_sys("epoll_ctl error");
+#endif
+	if ( (c->err = err) != 0) {
+		close(c->fd);
+		c->fd = -1;
+		return;
+	}
+	c->handshake = time_ns() - c->t_start;
+	if ( (flags = fcntl(c->fd, F_GETFL, 0)) < 0 ||
+	    fcntl(c->fd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+		err_sys("fcntl error");
+	cli_connected(c->fd);		/* sockopts(fd, 1) */
+}
+
+/*
+ * The connect on "c" has completed one way or the other.
+ */
+static void
+conn_ready(struct conn *c)
+{
+	socklen_t	optlen;
+	int		err;
+
+	err = 0;
+	optlen = sizeof(err);
+	if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &optlen) < 0)
+		err = errno;
+	conn_done(c, err);
+}
+
+/*
+ * Wait up to "ms" (-1 = forever) for connects to complete.  Returns 0
+ * on timeout.
+ */
+static int
+conn_wait(int ms)
+{
+	int	i, n;
+
+#ifdef	HAVE_SYS_EPOLL_H
+	struct epoll_event	ev[64];
+
+	if ( (n = epoll_wait(epfd, ev, 64, ms)) < 0) {
+		if (errno == EINTR)
+			return(1);
+		err_sys("epoll_wait error");
+	}
+	for (i = 0; i < n; i++)
+		conn_ready(&conns[ev[i].data.u32]);
+#else
+	struct pollfd	*pfd;
+	int		 j, *idx;
+
+	pfd = calloc(npending, sizeof(struct pollfd));
+	idx = calloc(npending, sizeof(int));
+	if (pfd == NULL || idx == NULL)
+		err_sys("calloc error");
+	for (i = j = 0; i < nconns; i++) {
+		if (!conns[i].pending)
+			continue;
+		pfd[j].fd = conns[i].fd;
+		pfd[j].events = POLLOUT;
+		idx[j++] = i;
+	}
+	if ( (n = poll(pfd, j, ms)) < 0 && errno != EINTR)
+		err_sys("poll error");
+	for (i = 0; i < j; i++)
+		if (pfd[i].revents != 0)
+			conn_ready(&conns[idx[i]]);
+	free(pfd);
+	free(idx);
+	if (n < 0)
+		return(1);
+#endif
+	return(n);
+}
+
+/*
+ * Start all the connects, and wait for them.
+ */
+static void
+conn_open(char *host, char *port)
+{
+	struct sockaddr	*sa;
+	socklen_t	 salen;
+	uint64_t	 deadline, now;
+	int		 i, flags, ms;
+
+	if (destlist == NULL)
+		cli_resolve(host, port);	/* else done by fanout_init() */
+#ifdef	HAVE_SYS_EPOLL_H
+	if ( (epfd = epoll_create(nconns)) < 0)
+		err_sys("epoll_create error");
+#endif
+
+	npending = 0;
+	for (i = 0; i < nconns; i++) {
+		struct conn	*c = &conns[i];
+
+		c->fd = cli_socket();		/* sockopts(fd, 0) */
+		c->err = errno;			/* if socket() or bind() failed */
+		if (destlist != NULL)
+			c->dest = fanout_pick(i, c->fd, &sa, &salen);
+		else
+			sa = cli_servaddr(&salen);	/* round-robin */
+		if (c->fd < 0)
+			continue;
+		c->err = 0;
+		if ( (flags = fcntl(c->fd, F_GETFL, 0)) < 0 ||
+		    fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+			err_sys("fcntl error");
+#ifdef	HAVE_SYS_EPOLL_H
+		{
+		struct epoll_event	ev;
+
+		bzero(&ev, sizeof(ev));
+		ev.events = EPOLLOUT;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+			err_sys("epoll_ctl error");
+		}
+#endif
+		c->pending = 1;
+		npending++;
+		c->t_start = time_ns();
+		if (connect(c->fd, sa, salen) == 0)
+			conn_done(c, 0);
+		else if (errno != EINPROGRESS)
+			conn_done(c, errno);
+	}
+
+	deadline = conntimeout ? time_ns() + conntimeout * 1000000ULL : 0;
+	while (npending > 0) {
+		ms = -1;
+		if (deadline) {
+			now = time_ns();
+			ms = (now < deadline) ?
+			    (deadline - now + 999999) / 1000000 : 0;
+		}
+		if (conn_wait(ms) == 0 && deadline && time_ns() >= deadline)
+			break;
+	}
+	for (i = 0; i < nconns && npending > 0; i++)
+		if (conns[i].pending)
+			conn_done(&conns[i], ETIMEDOUT);
+#ifdef	HAVE_SYS_EPOLL_H
+	close(epfd);
+#endif
+}
+
+static void *
+conn_thread(void *arg)
+{
+	struct conn	*c = arg;
+
+	if (!client) {
+		if (l4_prot == L4_PROT_SCTP)
+			sink_sctp(c->fd);
+		else
+			sink_tcp(c->fd);
+	} else if (l4_prot == L4_PROT_UDP)
+		source_udp(c->fd);
+	else if (l4_prot == L4_PROT_SCTP)
+		source_sctp(c->fd);
+	else
+		source_tcp(c->fd);
+	c->stats = stats;		/* this thread's */
+	c->havecpu = (cpu_thread_usage(&c->cpu_user_ns, &c->cpu_sys_ns) == 0);
+	return(NULL);
+}
+
+/*
+ * This connection's counters, for --results.
+ */
+static void
+conn_results(int i, struct conn *c)
+{
+	results_u64(RES_STREAM, i, "conn", i);
+	if (destlist != NULL)
+		results_str(RES_STREAM, i, "dest", fanout_name(c->dest));
+	if (client)
+		results_dbl(RES_STREAM, i, "handshake_us", c->handshake / 1e3);
+	results_dbl(RES_STREAM, i, "secs",
+	    (c->stats.end_ns - c->stats.start_ns) / 1e9);
+	if (c->havecpu) {
+		results_dbl(RES_STREAM, i, "cpu_user_s", c->cpu_user_ns / 1e9);
+		results_dbl(RES_STREAM, i, "cpu_sys_s", c->cpu_sys_ns / 1e9);
+	}
+	if (!client) {
+		results_u64(RES_STREAM, i, "rx_bytes", c->stats.rx_bytes);
+		results_u64(RES_STREAM, i, "rx_msgs", c->stats.rx_msgs);
+		return;
+	}
+	results_u64(RES_STREAM, i, "tx_bytes", c->stats.tx_bytes);
+	results_u64(RES_STREAM, i, "tx_msgs", c->stats.tx_msgs);
+	results_u64(RES_STREAM, i, "tx_errors", c->stats.tx_errors);
+}
+
+/*
+ * Wait for each connection's thread and add up their counters in this
+ * thread's "stats".
+ */
+static void
+conn_collect(void)
+{
+	struct conn	*c;
+	int		 i;
+	double		 secs;
+
+	bzero(&stats, sizeof(stats));
+	for (i = 0; i < nconns; i++) {
+		c = &conns[i];
+		if (c->fd < 0) {
+			if (destlist != NULL)
+				fanout_account(c->dest, c->err, NULL);
+			continue;
+		}
+		pthread_join(c->tid, NULL);
+		if (destlist != NULL)
+			fanout_account(c->dest, 0, &c->stats);
+		conn_results(i, c);
+		if (verbose) {
+			secs = (c->stats.end_ns - c->stats.start_ns) / 1e9;
+			if (client)
+				fprintf(stderr, "connection %d: handshake "
+				    "%.1f us, sent %llu bytes, %.3f Mbit/s", i,
+				    c->handshake / 1e3,
+				    (unsigned long long) c->stats.tx_bytes,
+				    secs > 0 ? c->stats.tx_bytes * 8 / secs / 1e6 :
+				    0.0);
+			else
+				fprintf(stderr, "connection %d: received %llu "
+				    "bytes, %.3f Mbit/s", i,
+				    (unsigned long long) c->stats.rx_bytes,
+				    secs > 0 ? c->stats.rx_bytes * 8 / secs / 1e6 :
+				    0.0);
+			if (c->havecpu)
+				fprintf(stderr, ", cpu %.3f sec user, %.3f sec "
+				    "sys", c->cpu_user_ns / 1e9,
+				    c->cpu_sys_ns / 1e9);
+			fprintf(stderr, "\n");
+		}
+		if (stats.start_ns == 0 || c->stats.start_ns < stats.start_ns)
+			stats.start_ns = c->stats.start_ns;
+		if (c->stats.end_ns > stats.end_ns)
+			stats.end_ns = c->stats.end_ns;
+		stats_add(&stats, &c->stats);
+	}
+}
+
+/*
+ * Open --conns connections in parallel, run the source on each, and
+ * leave the totals in this thread's "stats" for stats_report().
+ */
+void
+conn_run(char *host, char *port)
+{
+	struct hist	 h;
+	struct conn	*c;
+	int		 i, rc, nok;
+	uint64_t	 t;
+
+	if ( (conns = calloc(nconns, sizeof(struct conn))) == NULL)
+		err_sys("calloc error for --conns");
+	t = time_ns();
+	conn_open(host, port);
+	t = time_ns() - t;
+
+	hist_init(&h);
+	nok = 0;
+	for (i = 0; i < nconns; i++) {
+		c = &conns[i];
+		if (c->fd < 0) {
+			fprintf(stderr, "connection %d: connect error: %s%s\n",
+			    i, strerror(c->err), srcpool_exhausted(c->err) ?
+			    " (out of local ports?)" : "");
+			continue;
+		}
+		hist_add(&h, c->handshake);
+		results_sockopts(c->fd);	/* the first one's */
+		nok++;
+	}
+	fprintf(stderr, "%d of %d connections established in %.3f ms\n",
+	    nok, nconns, t / 1e6);
+	hist_report(&h, "handshake");
+	if (nok == 0)
+		err_quit("no connections");
+
+	for (i = 0; i < nconns; i++) {
+		if (conns[i].fd < 0)
+			continue;
+		if ( (rc = pthread_create(&conns[i].tid, NULL, conn_thread,
+		    &conns[i])) != 0) {
+			errno = rc;
+			err_sys("pthread_create error");
+		}
+	}
+
+	conn_collect();
+	if (destlist != NULL)
+		fanout_report();
+}
+
+/*
+ * The "sink" server:  accept --conns connections on "listenfd", run the
+ * sink on each in its own thread as it comes in, and leave the totals in
+ * this thread's "stats" for stats_report().
+ */
+void
+conn_serve(int listenfd)
+{
+	struct conn	*c;
+	int		 i, rc;
+
+	if ( (conns = calloc(nconns, sizeof(struct conn))) == NULL)
+		err_sys("calloc error for --conns");
+	for (i = 0; i < nconns; i++) {
+		c = &conns[i];
+		while ( (c->fd = accept(listenfd, NULL, NULL)) < 0)
+			if (errno != EINTR)
+				err_sys("accept() error");
+		buffers(c->fd);		/* as servopen() does */
+		sockopts(c->fd, 1);
+		results_sockopts(c->fd);	/* the first one's */
+		if ( (rc = pthread_create(&c->tid, NULL, conn_thread,
+		    c)) != 0) {
+			errno = rc;
+			err_sys("pthread_create error");
+		}
+	}
+	close(listenfd);
+	conn_collect();
+}
@@ -0,0 +1,148 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Small-write batching for TCP.  With --cork n, the socket is corked
+ * (TCP_CORK, or TCP_NOPUSH on BSD) before the first of every "n" logical
+ * writes and uncorked after the last, so the "n" writes go out as full
+ * segments.  With --msg-more n, the first n-1 writes of each group are
+ * sent with MSG_MORE instead, and the last without it.
+ *
+ * At the end, the number of data segments sent (from TCP_INFO) is
+ * reported per logical write, which is the packet-rate saving compared
+ * with sending each small write on its own.
+ */
+
+#include "sock.h"
+
+#if	!defined(TCP_CORK) && defined(TCP_NOPUSH)
+#define	TCP_CORK	TCP_NOPUSH	/* BSD equivalent */
+#endif
+
+static int	batchcnt;	/* #writes so far in the current group */
+static int	corked;		/* socket is corked now */
+static uint64_t	nlogical;	/* #logical writes */
+static uint64_t	segs_start;	/* data segments sent before first write */
+
+static void
+cork_set(int sockfd, int on)
+{
+#ifdef	TCP_CORK
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) < 0)
+		err_sys("TCP_CORK setsockopt error");
+	corked = on;
+#endif
+}
+
+/*
+ * Called once the connection is established, before the first write.
+ */
+void
+cork_init(int sockfd)
+{
+	struct tcpstat	ts;
+
+#ifndef	TCP_CORK
+	if (corkwrites)
+		err_quit("TCP_CORK not supported by host");
+#endif
+#ifndef	MSG_MORE
+	if (msgmore)
+		err_quit("MSG_MORE not supported by host");
+#endif
+	batchcnt = 0;		/* new connection, with --cc-compare */
+	nlogical = 0;
+	if (tcpinfo_get(sockfd, &ts) == 0)
+		segs_start = ts.data_segs_out;
+}
+
+/*
+ * Write the header (if any) and data as one logical write, which is
+ * one member of a --cork or --msg-more group.
+ */
+ssize_t
+cork_write(int sockfd, const void *hdr, size_t hdrlen,
+    const void *vptr, size_t nbytes)
+{
+	ssize_t	n;
+	int	flags;
+
+	nlogical++;
+	if (corkwrites) {
+		if (batchcnt == 0)
+			cork_set(sockfd, 1);
+		n = dowrite_hdr(sockfd, hdr, hdrlen, vptr, nbytes);
+		if (++batchcnt == corkwrites) {
+			cork_set(sockfd, 0);	/* pushes the group out */
+			batchcnt = 0;
+		}
+		return(n);
+	}
+
+	flags = 0;
+#ifdef	MSG_MORE
+	if (++batchcnt < msgmore)
+		flags = MSG_MORE;
+	else
+		batchcnt = 0;
+#endif
+	return(dosend_hdr(sockfd, hdr, hdrlen, vptr, nbytes, flags));
+}
+
+/*
+ * Push out a partial group:  at EOF, or before close().  An empty send()
+ * doesn't do it for MSG_MORE (Linux only pushes when it copies data), but
+ * turning TCP_NODELAY on does; it is then put back as -N left it.
+ */
+void
+cork_flush(int sockfd)
+{
+	int	on;
+
+	if (corked)
+		cork_set(sockfd, 0);
+	else if (batchcnt != 0) {
+		on = 1;
+		if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY,
+		    &on, sizeof(on)) < 0)
+			err_sys("TCP_NODELAY setsockopt error");
+		on = nodelay;
+		if (!on && setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY,
+		    &on, sizeof(on)) < 0)
+			err_sys("TCP_NODELAY setsockopt error");
+	}
+	batchcnt = 0;
+}
+
+/*
+ * Report data segments sent per logical write, once everything queued
+ * has been sent.
+ */
+void
+cork_report(int sockfd)
+{
+	struct tcpstat	ts;
+	uint64_t	nsegs;
+
+	cork_flush(sockfd);
+	if (tcpinfo_drain(sockfd, &ts) < 0) {
+		fprintf(stderr, "%llu logical writes; "
+		    "TCP_INFO not supported by host\n",
+		    (unsigned long long) nlogical);
+		return;
+	}
+
+	if (ts.data_segs_out == 0) {
+		fprintf(stderr, "%llu logical writes; "
+		    "segment count not reported by host\n",
+		    (unsigned long long) nlogical);
+		return;
+	}
+	nsegs = ts.data_segs_out - segs_start;
+	fprintf(stderr, "%s %d: %llu logical writes in %llu data segments",
+	    corkwrites ? "cork" : "MSG_MORE",
+	    corkwrites ? corkwrites : msgmore,
+	    (unsigned long long) nlogical, (unsigned long long) nsegs);
+	if (nlogical != 0)
+		fprintf(stderr, ", %.3f segments per write",
+		    (double) nsegs / nlogical);
+	fprintf(stderr, "\n");
+}
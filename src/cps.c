@@ -0,0 +1,356 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Connection rate benchmark, with --cps n.  Instead of one connection,
+ * the client makes "n" TCP (or SCTP) connections in all, from
+ * --cps-threads threads, each keeping --cps-conc non-blocking connects
+ * in flight.  Each connection optionally writes --cps-payload bytes and
+ * reads --cps-reply bytes back, then is closed; with -L 0 the close is
+ * abortive, so the client doesn't fill up with TIME_WAIT.
+ *
+ * With --fastopen the payload is sent with sendto(MSG_FASTOPEN) in
+ * place of connect(), so that it goes with the SYN once the server has
+ * given us a TFO cookie; the connections that did so are counted.
+ *
+ * Reported:  connections per second, percentiles of connect time (from
+ * connect() to writable) and of the whole connection, and the failures
+ * by errno.
+ */
+
+#include "sock.h"
+#include "probes.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#ifndef	MSG_NOSIGNAL
+#define	MSG_NOSIGNAL	0
+#define	CPS_IGNPIPE		/* so ignore SIGPIPE instead */
+#endif
+
+#define	CPS_NERRNO	256		/* errno values counted separately */
+
+enum { CPS_IDLE, CPS_CONNECTING, CPS_WRITING, CPS_READING };
+
+struct cpsconn {
+	int		fd;
+	int		state;		/* CPS_xxx */
+	uint64_t	t_start;	/* connect() called */
+	int		nwritten;
+	int		nread;
+};
+
+struct cpsthread {
+	pthread_t	tid;
+	uint64_t	nok;
+	uint64_t	nfastopen;	/* data went with the SYN */
+	uint64_t	nfail[CPS_NERRNO];	/* [0] is "other" */
+	struct hist	h_connect;
+	struct hist	h_conn;		/* connect() to close() */
+};
+
+static uint64_t		 started;	/* connections started, all threads */
+static char		*payload;
+
+/*
+ * Take the next connection to start, if any are left.
+ */
+static int
+cps_ticket(void)
+{
+	return(__sync_fetch_and_add(&started, 1) < (uint64_t) cpsconns);
+}
+
+static void
+cps_fail(struct cpsthread *t, struct cpsconn *c, int err)
+{
+	t->nfail[(err > 0 && err < CPS_NERRNO) ? err : 0]++;
+	if (c->fd >= 0) {
+		PROBE1(conn__close, c->fd);
+		close(c->fd);
+	}
+	c->fd = -1;
+	c->state = CPS_IDLE;
+}
+
+static void
+cps_done(struct cpsthread *t, struct cpsconn *c)
+{
+	hist_add(&t->h_conn, time_ns() - c->t_start);
+	t->nok++;
+	PROBE1(conn__close, c->fd);
+	if (close(c->fd) < 0)
+		err_sys("close error");
+	c->fd = -1;
+	c->state = CPS_IDLE;
+}
+
+/*
+ * Connected:  go on to write, read or close.
+ */
+static void
+cps_next(struct cpsthread *t, struct cpsconn *c)
+{
+	if (c->state == CPS_CONNECTING && c->nwritten < cpspayload)
+		c->state = CPS_WRITING;
+	else if (c->state != CPS_READING && cpsreply > 0)
+		c->state = CPS_READING;
+	else
+		cps_done(t, c);
+}
+
+static void
+cps_connected(struct cpsthread *t, struct cpsconn *c)
+{
+	struct tcpstat	ts;
+
+	PROBE2(conn__open, c->fd, 0);
+	hist_add(&t->h_connect, time_ns() - c->t_start);
+	if (fastopen && tcpinfo_get(c->fd, &ts) == 0 && ts.syn_data)
+		t->nfastopen++;
+	sockopts(c->fd, 1);	/* e.g. -L 0 */
+	cps_next(t, c);
+}
+
+static void
+cps_start(struct cpsthread *t, struct cpsconn *c)
+{
+	struct sockaddr	*sa;
+	socklen_t	 salen;
+	int		 flags, n;
+
+	if ( (c->fd = cli_socket()) < 0) {	/* sockopts(fd, 0) */
+		cps_fail(t, c, errno);	/* socket() or bind() */
+		return;
+	}
+	if ( (flags = fcntl(c->fd, F_GETFL, 0)) < 0 ||
+	    fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		err_sys("fcntl error");
+	c->nwritten = 0;
+	c->nread = 0;
+	c->state = CPS_CONNECTING;
+
+	sa = cli_servaddr(&salen);
+	c->t_start = time_ns();
+#ifdef	MSG_FASTOPEN
+	if (fastopen && cpspayload > 0) {
+		/* without a cookie, nothing is sent until connected */
+		if ( (n = sendto(c->fd, payload, cpspayload,
+		    MSG_FASTOPEN | MSG_NOSIGNAL, sa, salen)) >= 0)
+			c->nwritten = n;
+		else if (errno != EINPROGRESS)
+			cps_fail(t, c, errno);
+		return;
+	}
+#endif
+	if (connect(c->fd, sa, salen) == 0)
+		cps_connected(t, c);
+	else if (errno != EINPROGRESS)
+		cps_fail(t, c, errno);
+}
+
+/*
+ * The socket for "c" is ready:  carry on with whatever it was doing.
+ */
+static void
+cps_ready(struct cpsthread *t, struct cpsconn *c, char *buf)
+{
+	socklen_t	optlen;
+	int		n, err;
+
+	switch (c->state) {
+	case CPS_CONNECTING:
+		err = 0;
+		optlen = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &optlen) < 0)
+			err = errno;
+		if (err != 0) {
+			cps_fail(t, c, err);
+			return;
+		}
+		cps_connected(t, c);
+		return;
+
+	case CPS_WRITING:
+		n = send(c->fd, payload + c->nwritten,
+		    cpspayload - c->nwritten, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				cps_fail(t, c, errno);
+			return;
+		}
+		if ( (c->nwritten += n) == cpspayload)
+			cps_next(t, c);
+		return;
+
+	case CPS_READING:
+		n = read(c->fd, buf, min(readlen, cpsreply - c->nread));
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				cps_fail(t, c, errno);
+			return;
+		}
+		if (n == 0) {
+			cps_fail(t, c, 0);	/* EOF before the whole reply */
+			return;
+		}
+		if ( (c->nread += n) == cpsreply)
+			cps_next(t, c);
+		return;
+	}
+}
+
+static void *
+cps_thread(void *arg)
+{
+	struct cpsthread	*t = arg;
+	struct cpsconn		*conns;
+	struct pollfd		*pfd;
+	char			*buf;
+	int			 i, n, nactive, more;
+
+	affinity_thread();		/* --cpus, before allocating */
+	conns = calloc(cpsconc, sizeof(struct cpsconn));
+	pfd = calloc(cpsconc, sizeof(struct pollfd));
+	buf = malloc(readlen);
+	if (conns == NULL || pfd == NULL || buf == NULL)
+		err_sys("malloc error for --cps");
+	for (i = 0; i < cpsconc; i++)
+		conns[i].fd = -1;
+
+	more = 1;
+	for ( ; ; ) {
+		nactive = 0;
+		for (i = 0; i < cpsconc; i++) {
+			if (conns[i].state == CPS_IDLE && more) {
+				if (cps_ticket())
+					cps_start(t, &conns[i]);
+				else
+					more = 0;
+			}
+			if (conns[i].state == CPS_IDLE) {
+				pfd[i].fd = -1;		/* ignored by poll() */
+				continue;
+			}
+			pfd[i].fd = conns[i].fd;
+			pfd[i].events = (conns[i].state == CPS_READING) ?
+			    POLLIN : POLLOUT;
+			pfd[i].revents = 0;
+			nactive++;
+		}
+		if (nactive == 0) {
+			if (!more)
+				break;
+			continue;	/* all failed at once; start more */
+		}
+
+		if ( (n = poll(pfd, cpsconc, -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			err_sys("poll error");
+		}
+		for (i = 0; i < cpsconc && n > 0; i++) {
+			if (pfd[i].fd < 0 || pfd[i].revents == 0)
+				continue;
+			n--;
+			cps_ready(t, &conns[i], buf);
+		}
+	}
+
+	free(conns);
+	free(pfd);
+	free(buf);
+	return(NULL);
+}
+
+void
+cps_run(char *host, char *port)
+{
+	struct cpsthread	*threads, total;
+	uint64_t		 start, nfail, nports;
+	double			 secs;
+	int			 i, rc, e;
+
+#ifndef	MSG_FASTOPEN
+	if (fastopen)
+		err_quit("MSG_FASTOPEN not supported by host");
+#endif
+#ifdef	CPS_IGNPIPE
+	signal(SIGPIPE, SIG_IGN);	/* a write after the peer's RST */
+#endif
+	cli_resolve(host, port);
+	if ( (i = cli_socket()) >= 0)	/* check the options; buffers() */
+		close(i);
+	if ( (payload = malloc(cpspayload + 1)) == NULL)
+		err_sys("malloc error for --cps-payload");
+	pattern(payload, cpspayload);
+
+	if ( (threads = calloc(cpsthreads, sizeof(struct cpsthread))) == NULL)
+		err_sys("calloc error for --cps-threads");
+	start = time_ns();
+	for (i = 0; i < cpsthreads; i++) {
+		hist_init(&threads[i].h_connect);
+		hist_init(&threads[i].h_conn);
+		if ( (rc = pthread_create(&threads[i].tid, NULL, cps_thread,
+		    &threads[i])) != 0) {
+			errno = rc;
+			err_sys("pthread_create error");
+		}
+	}
+
+	bzero(&total, sizeof(total));
+	hist_init(&total.h_connect);
+	hist_init(&total.h_conn);
+	for (i = 0; i < cpsthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		total.nok += threads[i].nok;
+		total.nfastopen += threads[i].nfastopen;
+		for (e = 0; e < CPS_NERRNO; e++)
+			total.nfail[e] += threads[i].nfail[e];
+		hist_merge(&total.h_connect, &threads[i].h_connect);
+		hist_merge(&total.h_conn, &threads[i].h_conn);
+	}
+	secs = (time_ns() - start) / 1e9;
+
+	nfail = nports = 0;
+	for (e = 0; e < CPS_NERRNO; e++) {
+		nfail += total.nfail[e];
+		if (srcpool_exhausted(e))
+			nports += total.nfail[e];
+	}
+	fprintf(stderr, "%llu connections, %llu failed, in %.3f sec:  "
+	    "%.1f connections/sec (%d threads x %d concurrent)\n",
+	    (unsigned long long) total.nok, (unsigned long long) nfail,
+	    secs, secs > 0 ? total.nok / secs : 0.0, cpsthreads, cpsconc);
+	hist_report(&total.h_connect, "connect");
+	if (fastopen)
+		fprintf(stderr, "%llu connections sent their payload with the "
+		    "SYN (TCP Fast Open)\n",
+		    (unsigned long long) total.nfastopen);
+	if (cpspayload > 0 || cpsreply > 0)
+		hist_report(&total.h_conn, "connection");
+	if (nports != 0)
+		fprintf(stderr, "%llu failed for want of a local address and "
+		    "port (try --local-addrs)\n", (unsigned long long) nports);
+	if (total.nfail[0] != 0)
+		fprintf(stderr, "  %8llu  reply cut short or other error\n",
+		    (unsigned long long) total.nfail[0]);
+	for (e = 1; e < CPS_NERRNO; e++)
+		if (total.nfail[e] != 0)
+			fprintf(stderr, "  %8llu  errno %d (%s)\n",
+			    (unsigned long long) total.nfail[e], e, strerror(e));
+	if (verbose)
+		hist_hgrm(&total.h_connect, stderr);
+	affinity_report();
+
+	results_u64(RES_TOTAL, 0, "connections", total.nok);
+	results_u64(RES_TOTAL, 0, "failed", nfail);
+	results_dbl(RES_TOTAL, 0, "secs", secs);
+	results_dbl(RES_TOTAL, 0, "connections_per_sec",
+	    secs > 0 ? total.nok / secs : 0.0);
+	results_dbl(RES_TOTAL, 0, "connect_p50_us",
+	    hist_pct(&total.h_connect, 50) / 1e3);
+	results_dbl(RES_TOTAL, 0, "connect_p99_us",
+	    hist_pct(&total.h_connect, 99) / 1e3);
+	if (fastopen)
+		results_u64(RES_TOTAL, 0, "fastopen", total.nfastopen);
+}
@@ -0,0 +1,308 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * CPU cost of a "source" or "sink" run, with --cpu[=mhz]:  throughput
+ * alone doesn't say what it took, e.g. when comparing offloads.
+ *
+ * Each loop thread's user and system CPU time comes from
+ * getrusage(RUSAGE_THREAD), taken in stats_start() and stats_end() and
+ * kept in "stats", so --conns adds them up like the byte counts.  Where
+ * there is no RUSAGE_THREAD the whole process's time is taken instead,
+ * once, from cpu_start() to the report, so it isn't counted again for
+ * each thread.  Its share of the run's wall clock time is given as a
+ * percentage of one core, so several busy threads make over 100%.  Each
+ * --conns thread's own time is also given with its connection.  From
+ * the total and the clock rate (the mhz given, else cpufreq's maximum,
+ * else what /proc/cpuinfo says now) come cycles per byte and per write
+ * or read:  an estimate, since the clock may vary, but enough to
+ * compare runs on the same host; the summary says which rate it used.
+ *
+ * Besides our own threads, the kernel does much of the work in softirq
+ * context on whichever core takes the interrupts, not charged to us.
+ * So where there is a /proc, the per-core times in /proc/stat and the
+ * NET_TX and NET_RX counts in /proc/softirqs are read before and after
+ * the run, and the busy cores' utilization over the run is reported.
+ * Nothing is read in the data path.
+ */
+
+#define	_GNU_SOURCE		/* RUSAGE_THREAD */
+#include "sock.h"
+#include <ctype.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef	RUSAGE_THREAD
+#define	RUSAGE_WHO	RUSAGE_THREAD
+#else
+#define	RUSAGE_WHO	RUSAGE_SELF	/* see cpu_start() */
+#endif
+
+enum { CPU_USER, CPU_NICE, CPU_SYS, CPU_IDLE, CPU_IOWAIT, CPU_IRQ,
+       CPU_SOFTIRQ, CPU_STEAL, CPU_NSTATES };
+
+struct corestat {
+	uint64_t	ticks[CPU_NSTATES];	/* /proc/stat, USER_HZ */
+	uint64_t	net_tx, net_rx;		/* /proc/softirqs */
+};
+
+#ifdef	RUSAGE_THREAD
+static __thread uint64_t   user0, sys0;	/* this thread's, at start */
+#else
+static uint64_t		   procuser0, procsys0;	/* at cpu_start() */
+#endif
+static struct corestat	  *before;	/* [0] is all cores, [i + 1] core i */
+static int		   ncores;
+
+static void
+cpu_rusage(uint64_t *user, uint64_t *sys)
+{
+	struct rusage	ru;
+
+	if (getrusage(RUSAGE_WHO, &ru) < 0)
+		err_sys("getrusage error");
+	*user = ru.ru_utime.tv_sec * 1000000000ULL +
+	    ru.ru_utime.tv_usec * 1000ULL;
+	*sys = ru.ru_stime.tv_sec * 1000000000ULL +
+	    ru.ru_stime.tv_usec * 1000ULL;
+}
+
+/* Called from stats_start(), with --cpu. */
+void
+cpu_thread_start(void)
+{
+#ifdef	RUSAGE_THREAD
+	cpu_rusage(&user0, &sys0);
+#endif
+}
+
+/* And from stats_end(). */
+void
+cpu_thread_end(void)
+{
+#ifdef	RUSAGE_THREAD
+	uint64_t	user, sys;
+
+	cpu_rusage(&user, &sys);
+	stats.cpu_user_ns = user - user0;
+	stats.cpu_sys_ns = sys - sys0;
+#endif
+}
+
+/*
+ * The calling thread's CPU time so far, for the --conns threads' own
+ * figures.  Returns -1 where there is no RUSAGE_THREAD.
+ */
+int
+cpu_thread_usage(uint64_t *user, uint64_t *sys)
+{
+#ifdef	RUSAGE_THREAD
+	cpu_rusage(user, sys);
+	return(0);
+#else
+	return(-1);
+#endif
+}
+
+/*
+ * Read /proc/stat and /proc/softirqs into a calloc'ed array of
+ * ncores + 1.  Returns NULL if there is no /proc/stat.
+ */
+static struct corestat *
+cpu_read(void)
+{
+	struct corestat	*cs;
+	FILE		*fp;
+	char		 line[4096], *p, *q;
+	int		 i, n, j, istx;
+	uint64_t	 v;
+
+	if ( (fp = fopen("/proc/stat", "r")) == NULL)
+		return(NULL);
+	n = 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (strncmp(line, "cpu", 3) == 0 && isdigit((u_char) line[3]))
+			n++;
+	if (ncores == 0)
+		ncores = n;		/* the same for the "after" read */
+	if ( (cs = calloc(ncores + 1, sizeof(struct corestat))) == NULL)
+		err_sys("calloc error");
+
+	rewind(fp);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "cpu", 3) != 0)
+			continue;
+		if (line[3] == ' ')
+			i = 0;
+		else if ( (i = atoi(line + 3) + 1) > ncores)
+			continue;
+		p = line + 3;
+		while (*p != ' ' && *p != 0)
+			p++;
+		for (j = 0; j < CPU_NSTATES; j++) {
+			v = strtoull(p, &q, 10);
+			if (q == p)
+				break;	/* older kernels have fewer */
+			cs[i].ticks[j] = v;
+			p = q;
+		}
+	}
+	fclose(fp);
+
+	if ( (fp = fopen("/proc/softirqs", "r")) == NULL)
+		return(cs);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		for (p = line; *p == ' '; p++)
+			;
+		if (strncmp(p, "NET_TX:", 7) == 0)
+			istx = 1;
+		else if (strncmp(p, "NET_RX:", 7) == 0)
+			istx = 0;
+		else
+			continue;
+		q = p + 7;
+		for (i = 1; i <= ncores; i++) {
+			p = q;
+			v = strtoull(p, &q, 10);
+			if (q == p)
+				break;
+			if (istx) {
+				cs[i].net_tx = v;
+				cs[0].net_tx += v;
+			} else {
+				cs[i].net_rx = v;
+				cs[0].net_rx += v;
+			}
+		}
+	}
+	fclose(fp);
+	return(cs);
+}
+
+/*
+ * Take the "before" reading, once, before the loops start.
+ */
+void
+cpu_start(void)
+{
+	before = cpu_read();
+#ifndef	RUSAGE_THREAD
+	cpu_rusage(&procuser0, &procsys0);	/* the whole process */
+#endif
+}
+
+/*
+ * Clock rate in MHz:  --cpu=mhz, else cpufreq's maximum, else the first
+ * "cpu MHz" in /proc/cpuinfo.  0 if none of those.  "*from" says which.
+ */
+static double
+cpu_mhz(const char **from)
+{
+	FILE	*fp;
+	char	 line[256];
+	double	 mhz;
+
+	*from = "given";
+	if (cpumhz > 0)
+		return(cpumhz);
+	*from = "max";
+	mhz = 0;
+	if ( (fp = fopen("/sys/devices/system/cpu/cpu0/cpufreq/"
+	    "cpuinfo_max_freq", "r")) != NULL) {
+		if (fgets(line, sizeof(line), fp) != NULL)
+			mhz = atof(line) / 1000;	/* kHz */
+		fclose(fp);
+		if (mhz > 0)
+			return(mhz);
+	}
+	*from = "cpu0 now";
+	if ( (fp = fopen("/proc/cpuinfo", "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (strncmp(line, "cpu MHz", 7) == 0 &&
+			    strchr(line, ':') != NULL) {
+				mhz = atof(strchr(line, ':') + 1);
+				break;
+			}
+		fclose(fp);
+	}
+	return(mhz);
+}
+
+/*
+ * One line of utilization for core "i" (-1 for all of them together)
+ * from "b" to "a".
+ */
+static void
+cpu_core(int i, const struct corestat *b, const struct corestat *a)
+{
+	uint64_t	d[CPU_NSTATES], total;
+	int		j;
+
+	total = 0;
+	for (j = 0; j < CPU_NSTATES; j++) {
+		d[j] = a->ticks[j] - b->ticks[j];
+		total += d[j];
+	}
+	if (total == 0)
+		return;
+	if (i >= 0 && d[CPU_IDLE] + d[CPU_IOWAIT] == total)
+		return;			/* only the busy cores */
+	if (i < 0)
+		fprintf(stderr, "  all:  ");
+	else
+		fprintf(stderr, "  cpu%-3d", i);
+	fprintf(stderr, "%5.1f%% user, %5.1f%% sys, %5.1f%% irq, "
+	    "%5.1f%% softirq, %5.1f%% idle; NET_RX %llu, NET_TX %llu\n",
+	    100.0 * (d[CPU_USER] + d[CPU_NICE]) / total,
+	    100.0 * d[CPU_SYS] / total, 100.0 * d[CPU_IRQ] / total,
+	    100.0 * d[CPU_SOFTIRQ] / total,
+	    100.0 * (d[CPU_IDLE] + d[CPU_IOWAIT]) / total,
+	    (unsigned long long) (a->net_rx - b->net_rx),
+	    (unsigned long long) (a->net_tx - b->net_tx));
+}
+
+/*
+ * Print the CPU cost of the loops in "s", and the system-wide
+ * utilization since cpu_start().
+ */
+void
+cpu_report(const struct sockstats *s)
+{
+	struct corestat	*after;
+	uint64_t	 nbytes, nmsgs, cpu, user, sys, wall;
+	double		 mhz, cycles;
+	const char	*from;
+	int		 i;
+
+#ifdef	RUSAGE_THREAD
+	user = s->cpu_user_ns;
+	sys = s->cpu_sys_ns;
+#else
+	cpu_rusage(&user, &sys);	/* the whole process, once */
+	user -= procuser0;
+	sys -= procsys0;
+#endif
+	cpu = user + sys;
+	fprintf(stderr, "cpu: %.3f sec user, %.3f sec sys",
+	    user / 1e9, sys / 1e9);
+	wall = s->end_ns - s->start_ns;	/* not run_ns, summed over threads */
+	if (wall > 0)
+		fprintf(stderr, ", %.1f%% of a core", 100.0 * cpu / wall);
+	fprintf(stderr, "\n");
+
+	nbytes = s->tx_bytes + s->rx_bytes;
+	nmsgs = s->tx_msgs + s->rx_msgs;
+	if ( (mhz = cpu_mhz(&from)) > 0 && nbytes > 0) {
+		cycles = cpu / 1e3 * mhz;
+		fprintf(stderr, "cycles: %.2f per byte, %.0f per %s "
+		    "(at %.0f MHz, %s)\n", cycles / nbytes, cycles / nmsgs,
+		    l4_prot == L4_PROT_UDP ? "datagram" :
+		    client ? "write" : "read", mhz, from);
+	}
+
+	if (before == NULL || (after = cpu_read()) == NULL)
+		return;
+	fprintf(stderr, "system, over the run:\n");
+	cpu_core(-1, &before[0], &after[0]);
+	for (i = 0; i < ncores; i++)
+		cpu_core(i, &before[i + 1], &after[i + 1]);
+	free(after);
+}
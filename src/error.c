@@ -3,7 +3,7 @@
 #include	<stdarg.h>		/* ANSI C header file */
 #include	"ourhdr.h"
 
-static void	err_doit(int, const char *, va_list);
+static void	err_doit(int, int, const char *, va_list);
 
 char	*pname = NULL;		/* caller can set this from argv[0] */
 
@@ -17,7 +17,7 @@ err_ret(const char *fmt, ...)
 	va_list		ap;
 
 	va_start(ap, fmt);
-	err_doit(1, fmt, ap);
+	err_doit(1, 1, fmt, ap);
 	va_end(ap);
 	return;
 }
@@ -32,7 +32,7 @@ err_sys(const char *fmt, ...)
 	va_list		ap;
 
 	va_start(ap, fmt);
-	err_doit(1, fmt, ap);
+	err_doit(1, 0, fmt, ap);
 	va_end(ap);
 	exit(1);
 }
@@ -47,7 +47,7 @@ err_dump(const char *fmt, ...)
 	va_list		ap;
 
 	va_start(ap, fmt);
-	err_doit(1, fmt, ap);
+	err_doit(1, 0, fmt, ap);
 	va_end(ap);
 	abort();		/* dump core and terminate */
 	exit(1);		/* shouldn't get here */
@@ -63,7 +63,7 @@ err_msg(const char *fmt, ...)
 	va_list		ap;
 
 	va_start(ap, fmt);
-	err_doit(0, fmt, ap);
+	err_doit(0, 1, fmt, ap);
 	va_end(ap);
 	return;
 }
@@ -78,25 +78,32 @@ err_quit(const char *fmt, ...)
 	va_list		ap;
 
 	va_start(ap, fmt);
-	err_doit(0, fmt, ap);
+	err_doit(0, 0, fmt, ap);
 	va_end(ap);
 	exit(1);
 }
 
 /* Print a message and return to caller.
- * Caller specifies "errnoflag". */
+ * Caller specifies "errnoflag", and "queue" if the message may go
+ * through vlog.c's rings (nonfatal ones only). */
 
 static void
-err_doit(int errnoflag, const char *fmt, va_list ap)
+err_doit(int errnoflag, int queue, const char *fmt, va_list ap)
 {
-	int		errno_save;
+	int		errno_save, n;
 	char	buf[MAXLINE];
 
 	errno_save = errno;		/* value caller might want printed */
-	vsprintf(buf, fmt, ap);
-	if (errnoflag)
-		sprintf(buf+strlen(buf), ": %s", strerror(errno_save));
-	strcat(buf, "\n");
+	vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	if (errnoflag) {
+		n = strlen(buf);
+		snprintf(buf+n, sizeof(buf) - 1 - n, ": %s",
+		    strerror(errno_save));
+	}
+	strcat(buf, "\n");		/* room was left for it */
+	if (queue && vlog_put(buf) == 0)
+		return;			/* nonfatal, and vlog is writing */
+	vlog_flush();		/* what's queued goes first */
 	fflush(stdout);		/* in case stdout and stderr are the same */
 	fputs(buf, stderr);
 	fflush(stderr);		/* SunOS 4.1.* doesn't grok NULL argument */
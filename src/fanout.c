@@ -0,0 +1,236 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Fan-out to several servers, with --dests host:port[/w],...  The
+ * client's flows (the --conns connections, or one per destination and
+ * unit of weight) are spread over the destinations, and each runs the
+ * usual source loop through the --conns machinery, so TCP, UDP and SCTP
+ * all work as they do against one server.  With UDP each flow is a
+ * connected socket, so datagrams are spread flow by flow.  All the
+ * destinations must be of one address family:  IPv4, or IPv6 with -6.
+ *
+ * --dest-policy picks how:  "rr" assigns flows to destinations in turn,
+ * ignoring weights; "weighted" (the default) does smooth weighted
+ * round-robin, so that with weights 3 and 1 every four flows are
+ * a, a, b, a; "hash" hashes the flow's local address and port onto the
+ * weights, the way a load balancer hashes a flow's addresses, so that
+ * where a flow goes depends on its source port, not on its place in
+ * the order.
+ *
+ * Bytes, throughput, connect failures and write errors (with -E) are
+ * reported per destination.
+ */
+
+#include "sock.h"
+
+struct dest {
+	char			*name;		/* as given, without weight */
+	struct sockaddr_storage	 addr;
+	socklen_t		 addrlen;
+	int			 weight;
+	int			 current;	/* for smooth weighted rr */
+	int			 nflows, nfail;
+	uint64_t		 tx_bytes, tx_msgs, tx_errors;
+	uint64_t		 start_ns, end_ns;
+};
+
+static struct dest	*dests;
+static int		 ndests;
+static int		 totalweight;
+
+/*
+ * Parse and resolve the --dests list.
+ */
+void
+fanout_init(char *list)
+{
+	struct sockaddr	*sa;
+	struct dest	*d;
+	struct in_addr	 in4;
+	struct in6_addr	 in6;
+	char		*copy, *tok, *host, *port, *w;
+
+	if ( (copy = strdup(list)) == NULL)
+		err_sys("strdup error");
+	for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if ( (dests = realloc(dests,
+		    (ndests + 1) * sizeof(struct dest))) == NULL)
+			err_sys("realloc error for --dests");
+		d = &dests[ndests];
+		bzero(d, sizeof(*d));
+		d->weight = 1;
+		if ( (w = strchr(tok, '/')) != NULL) {
+			*w++ = 0;
+			if ( (d->weight = atoi(w)) <= 0)
+				err_quit("invalid weight in --dests: %s", w);
+		}
+		if ( (d->name = strdup(tok)) == NULL)
+			err_sys("strdup error");
+
+		/* host:port, or [v6addr]:port */
+		if ( (port = strrchr(tok, ':')) == NULL)
+			err_quit("--dests entry %s isn't host:port", tok);
+		*port++ = 0;
+		host = tok;
+		if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+			host++;
+			host[strlen(host) - 1] = 0;
+		}
+
+		/* every socket is made with af_46, so one family only */
+		if (af_46 != AF_INET6 && inet_pton(AF_INET6, host, &in6) == 1)
+			err_quit("--dests: %s is IPv6, which needs -6 (and "
+			    "then IPv6 destinations only)", d->name);
+		if (af_46 == AF_INET6 && inet_pton(AF_INET, host, &in4) == 1)
+			err_quit("--dests: %s is IPv4, which can't be mixed "
+			    "with -6", d->name);
+		cli_resolve(host, port);	/* first address only */
+		sa = cli_servaddr(&d->addrlen);
+		memcpy(&d->addr, sa, d->addrlen);
+
+		totalweight += d->weight;
+		ndests++;
+	}
+	free(copy);
+	if (ndests == 0)
+		err_quit("empty --dests list");
+}
+
+/*
+ * Number of flows that gives each destination its weight.
+ */
+int
+fanout_flows(void)
+{
+	return(totalweight);
+}
+
+/*
+ * For "hash":  the part of the flow's 4-tuple that is known before its
+ * destination is, i.e. its local address and port, on socket "fd".  An
+ * unbound socket is bound to an ephemeral port first (chosen without
+ * regard to the destination, unlike at connect()).  Where the port is
+ * left to connect() (--local-addrs without --local-ports), or there is
+ * no socket, the flow number stands in for it.
+ */
+static uint64_t
+fanout_hash(int flow, int fd)
+{
+	struct sockaddr_storage	 ss;
+	socklen_t		 len;
+	const u_char		*p;
+	uint64_t		 h;
+	size_t			 i, n;
+	int			 port;
+
+	h = 0xcbf29ce484222325ULL;		/* FNV-1a */
+	port = 0;
+	if (fd >= 0) {
+		len = sizeof(ss);
+		if (getsockname(fd, (struct sockaddr *) &ss, &len) < 0)
+			err_sys("getsockname() error");
+		if (((struct sockaddr_in *) &ss)->sin_port == 0 &&
+		    bind(fd, (struct sockaddr *) &ss, len) == 0 &&
+		    getsockname(fd, (struct sockaddr *) &ss, &len) < 0)
+			err_sys("getsockname() error");
+		if (ss.ss_family == AF_INET6) {
+			p = (u_char *) &((struct sockaddr_in6 *) &ss)->sin6_addr;
+			n = sizeof(struct in6_addr);
+			port = ntohs(((struct sockaddr_in6 *) &ss)->sin6_port);
+		} else {
+			p = (u_char *) &((struct sockaddr_in *) &ss)->sin_addr;
+			n = sizeof(struct in_addr);
+			port = ntohs(((struct sockaddr_in *) &ss)->sin_port);
+		}
+		for (i = 0; i < n; i++)
+			h = (h ^ p[i]) * 0x100000001b3ULL;
+	}
+	h = (h ^ (port ? (uint64_t) port : flow + 65536ULL)) *
+	    0x100000001b3ULL;
+	h = (h ^ l4_prot) * 0x100000001b3ULL;
+
+	h ^= h >> 30;				/* splitmix64's finish */
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	return(h ^ (h >> 31));
+}
+
+/*
+ * Choose the destination for flow "flow" (0, 1, ... in order) on socket
+ * "fd" (-1 if it couldn't be opened), and return its index and address.
+ */
+int
+fanout_pick(int flow, int fd, struct sockaddr **sap, socklen_t *lenp)
+{
+	uint64_t	h;
+	int		i, best;
+
+	if (destpolicy == DEST_RR) {
+		best = flow % ndests;
+	} else if (destpolicy == DEST_HASH) {
+		h = fanout_hash(flow, fd) % totalweight;
+		for (best = 0; h >= (uint64_t) dests[best].weight; best++)
+			h -= dests[best].weight;
+	} else {
+		/* smooth weighted round-robin, as in nginx */
+		best = 0;
+		for (i = 0; i < ndests; i++) {
+			dests[i].current += dests[i].weight;
+			if (dests[i].current > dests[best].current)
+				best = i;
+		}
+		dests[best].current -= totalweight;
+	}
+	*sap = (struct sockaddr *) &dests[best].addr;
+	*lenp = dests[best].addrlen;
+	return(best);
+}
+
+const char *
+fanout_name(int i)
+{
+	return(dests[i].name);
+}
+
+/*
+ * Add up one flow to destination "i":  "err" if it couldn't be opened,
+ * else the counters from its source loop.
+ */
+void
+fanout_account(int i, int err, const struct sockstats *st)
+{
+	struct dest	*d = &dests[i];
+
+	d->nflows++;
+	if (err != 0) {
+		d->nfail++;
+		return;
+	}
+	if (d->start_ns == 0 || st->start_ns < d->start_ns)
+		d->start_ns = st->start_ns;
+	if (st->end_ns > d->end_ns)
+		d->end_ns = st->end_ns;
+	d->tx_bytes += st->tx_bytes;
+	d->tx_msgs += st->tx_msgs;
+	d->tx_errors += st->tx_errors;
+}
+
+void
+fanout_report(void)
+{
+	struct dest	*d;
+	double		 secs;
+	int		 i;
+
+	for (i = 0; i < ndests; i++) {
+		d = &dests[i];
+		secs = (d->end_ns - d->start_ns) / 1e9;
+		fprintf(stderr, "%s (weight %d): %d flows, %d failed, "
+		    "sent %llu bytes in %llu writes, %.3f Mbit/s, "
+		    "%llu write errors\n", d->name, d->weight, d->nflows,
+		    d->nfail, (unsigned long long) d->tx_bytes,
+		    (unsigned long long) d->tx_msgs,
+		    secs > 0 ? d->tx_bytes * 8 / secs / 1e6 : 0.0,
+		    (unsigned long long) d->tx_errors);
+	}
+}
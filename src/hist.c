@@ -0,0 +1,173 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Latency histograms, in the style of HdrHistogram:  values (in ns) up to
+ * 2^HIST_SUB_BITS are counted exactly, and larger ones in buckets of
+ * 2^HIST_SUB_BITS sub-buckets per power of two, so any value is
+ * recorded to within 1 part in 2^HIST_SUB_BITS, from nanoseconds up to
+ * centuries, in a fixed-size array.  Recording is a few shifts and an
+ * increment; percentiles are found by walking the counts.
+ *
+ * hist_hgrm() prints the percentile distribution in the same layout as
+ * HdrHistogram's outputPercentileDistribution(), so existing plotting
+ * tools for .hgrm files can read it.
+ */
+
+#include "sock.h"
+#include <math.h>
+
+#define	HIST_SUB	(1 << HIST_SUB_BITS)
+#define	HIST_NCOUNTS	(HIST_SUB * (64 - HIST_SUB_BITS + 1))
+#define	HIST_TICKS	5	/* hist_hgrm() lines per halving */
+
+static int
+hist_index(uint64_t v)
+{
+	int	e;
+
+	if (v < HIST_SUB)
+		return(v);
+	e = 63 - __builtin_clzll(v);		/* floor(log2(v)) */
+	return((e - HIST_SUB_BITS + 1) * HIST_SUB +
+	    (int) ((v >> (e - HIST_SUB_BITS)) - HIST_SUB));
+}
+
+/*
+ * Highest value that is recorded in counts[i].
+ */
+static uint64_t
+hist_value(int i)
+{
+	int	shift;
+
+	if (i < HIST_SUB)
+		return(i);
+	shift = i / HIST_SUB - 1;
+	return((((uint64_t) (i % HIST_SUB + HIST_SUB) + 1) << shift) - 1);
+}
+
+void
+hist_init(struct hist *h)
+{
+	bzero(h, sizeof(*h));
+	if ( (h->counts = calloc(HIST_NCOUNTS, sizeof(uint64_t))) == NULL)
+		err_sys("calloc error for histogram");
+}
+
+void
+hist_add(struct hist *h, uint64_t v)
+{
+	if (h->count == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->sum += v;
+	h->sumsq += (double) v * v;
+	h->count++;
+	h->counts[hist_index(v)]++;
+}
+
+/*
+ * Add the counts of "src" into "dst", e.g. one per thread.
+ */
+void
+hist_merge(struct hist *dst, const struct hist *src)
+{
+	int	i;
+
+	if (src->count == 0)
+		return;
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->sum += src->sum;
+	dst->sumsq += src->sumsq;
+	dst->count += src->count;
+	for (i = 0; i < HIST_NCOUNTS; i++)
+		dst->counts[i] += src->counts[i];
+}
+
+/*
+ * Value at percentile "pct" (0-100).
+ */
+uint64_t
+hist_pct(const struct hist *h, double pct)
+{
+	uint64_t	want, seen;
+	int		i;
+
+	if (h->count == 0)
+		return(0);
+	want = (uint64_t) ceil(pct / 100 * h->count);
+	if (want == 0)
+		want = 1;
+	seen = 0;
+	for (i = 0; i < HIST_NCOUNTS; i++) {
+		if ( (seen += h->counts[i]) >= want)
+			return(min(hist_value(i), h->max));
+	}
+	return(h->max);
+}
+
+/*
+ * One line summary, values printed in microseconds.
+ */
+void
+hist_report(const struct hist *h, const char *name)
+{
+	if (h->count == 0) {
+		fprintf(stderr, "%s: no samples\n", name);
+		return;
+	}
+	fprintf(stderr, "%s (us): %llu samples, min %.1f, p50 %.1f, "
+	    "p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f, mean %.1f\n",
+	    name, (unsigned long long) h->count, h->min / 1e3,
+	    hist_pct(h, 50) / 1e3, hist_pct(h, 90) / 1e3,
+	    hist_pct(h, 99) / 1e3, hist_pct(h, 99.9) / 1e3,
+	    h->max / 1e3, h->sum / h->count / 1e3);
+}
+
+/*
+ * Full percentile distribution, values in microseconds.
+ */
+void
+hist_hgrm(const struct hist *h, FILE *fp)
+{
+	double		pct, mean, var;
+	uint64_t	seen;
+	int		i, halvings;
+
+	fprintf(fp, "%12s %14s %10s %14s\n\n",
+	    "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+	if (h->count == 0)
+		return;
+
+	seen = 0;
+	pct = 0;		/* next percentile to print */
+	for (i = 0; i < HIST_NCOUNTS && pct < 100; i++) {
+		if (h->counts[i] == 0)
+			continue;
+		seen += h->counts[i];
+		while (seen * 100.0 / h->count >= pct && pct < 100) {
+			fprintf(fp, "%12.3f %2.12f %10llu %14.2f\n",
+			    min(hist_value(i), h->max) / 1e3, pct / 100,
+			    (unsigned long long) seen, 100 / (100 - pct));
+			/* HIST_TICKS lines per halving of distance to 100% */
+			halvings = (int) floor(log2(100 / (100 - pct)));
+			pct += 100 / (HIST_TICKS * pow(2, halvings + 1));
+			if (seen == h->count)
+				break;
+		}
+	}
+	fprintf(fp, "%12.3f %2.12f %10llu %14s\n",
+	    h->max / 1e3, 1.0, (unsigned long long) h->count, "inf");
+
+	mean = h->sum / h->count;
+	var = h->sumsq / h->count - mean * mean;
+	fprintf(fp, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+	    mean / 1e3, (var > 0 ? sqrt(var) : 0) / 1e3);
+	fprintf(fp, "#[Max     = %12.3f, Total count    = %12llu]\n",
+	    h->max / 1e3, (unsigned long long) h->count);
+	fprintf(fp, "#[Buckets = %12d, SubBuckets     = %12d]\n",
+	    64 - HIST_SUB_BITS + 1, HIST_SUB);
+}
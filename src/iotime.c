@@ -0,0 +1,86 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Where the time goes, with --io-time n:  one in every "n" writes (source)
+ * or reads (sink) is timed, from just before the system call to just
+ * after, into a histogram, so a write that blocked on a full send
+ * buffer shows up in the tail; and the time in sleep_us() is added up.
+ * At the end the run time is split into time in send/recv (estimated
+ * from the timed calls), pacing sleeps (-p etc.), and everything else,
+ * i.e. our own work:  a source that is CPU bound spends little time in
+ * write(), one held back by the network a lot.
+ *
+ * Each thread times into its own histogram, which is merged into the
+ * total under a lock when its loop is done (stats_end()).
+ */
+
+#include "sock.h"
+#include <pthread.h>
+
+static __thread struct hist	 iohist;	/* this thread's */
+static struct hist		 iohist_all;	/* of loops that are done */
+static pthread_mutex_t		 iohist_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Called by iotime_done() after a timed call.
+ */
+void
+iotime_add(void)
+{
+	uint64_t	dt;
+
+	dt = time_ns() - stats.io_t0;
+	stats.io_t0 = 0;
+	stats.io_timed++;
+	stats.io_ns += dt;
+	if (iohist.counts == NULL)
+		hist_init(&iohist);
+	hist_add(&iohist, dt);
+}
+
+/*
+ * This thread's loop is done:  add its histogram to the total.
+ */
+void
+iotime_merge(void)
+{
+	if (iohist.counts == NULL)
+		return;
+	pthread_mutex_lock(&iohist_lock);
+	if (iohist_all.counts == NULL)
+		hist_init(&iohist_all);
+	hist_merge(&iohist_all, &iohist);
+	pthread_mutex_unlock(&iohist_lock);
+	free(iohist.counts);
+	bzero(&iohist, sizeof(iohist));
+}
+
+/*
+ * Print the histogram, and the split of the run time in "s":  the sum
+ * over all threads of their loops' run times, so with --conns each
+ * connection counts for its own time.
+ */
+void
+iotime_report(const struct sockstats *s)
+{
+	double	io, sleep, user, total;
+
+	pthread_mutex_lock(&iohist_lock);
+	if (iohist_all.counts != NULL)
+		hist_report(&iohist_all, client ? "write" : "read");
+	pthread_mutex_unlock(&iohist_lock);
+
+	if (s->run_ns == 0 || s->io_timed == 0)
+		return;
+	total = s->run_ns;
+	io = (double) s->io_ns * s->io_ops / s->io_timed;
+	sleep = s->sleep_ns;
+	user = total - io - sleep;
+	if (user < 0)
+		user = 0;	/* "io" is an estimate */
+	fprintf(stderr, "time: %.1f%% in %s, %.1f%% pacing sleep, "
+	    "%.1f%% user work (of %.3f sec, %llu of %llu calls timed)\n",
+	    100 * io / total, client ? "write" : "read",
+	    100 * sleep / total, 100 * user / total, total / 1e9,
+	    (unsigned long long) s->io_timed,
+	    (unsigned long long) s->io_ops);
+}
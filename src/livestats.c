@@ -0,0 +1,148 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Counters so far, on SIGUSR1, while a source or sink keeps running:
+ * bytes, reads and writes, write errors, the rate over the whole run and
+ * since the last dump, and the delay histograms of --owd, --txstamp and
+ * --ackstamp where they are on.  E.g. "kill -USR1 <pid>" during a long
+ * sink run.
+ *
+ * Nothing is done in a signal handler.  SIGUSR1 is blocked before any
+ * other thread is started (so they all inherit the mask) and a thread
+ * of its own takes it with sigwait() and prints from there, so the data
+ * path sees no signal and no EINTR.
+ *
+ * tellwait.c uses SIGUSR1 and SIGUSR2 for the -F handshake, but only
+ * between the listening parent and a child that hasn't started its
+ * loop yet:  the parent ignores SIGUSR1 (see servopen()), and each
+ * child starts this after servopen() has returned, so send SIGUSR1 to
+ * the child serving the connection.
+ *
+ * With --results or --shm the same thread takes SIGINT and SIGTERM too,
+ * so that a run stopped by one still writes the file, or removes the
+ * shared memory segment (which is otherwise done at exit()), before it
+ * dies of the signal.
+ */
+
+#include "sock.h"
+#include <pthread.h>
+#include <signal.h>
+
+static sigset_t		 sigs;		/* taken with sigwait() */
+static uint64_t		 last_ns, last_tx, last_rx;	/* at last dump */
+
+static void
+livestats_dir(int tx, uint64_t nbytes, uint64_t nmsgs, uint64_t prev,
+    double secs, double dsecs)
+{
+	fprintf(stderr, "  %s %llu bytes in %llu %s",
+	    tx ? "sent" : "received", (unsigned long long) nbytes,
+	    (unsigned long long) nmsgs, tx ? "writes" : "reads");
+	if (secs > 0)
+		fprintf(stderr, ", %.3f Mbit/s", nbytes * 8 / secs / 1e6);
+	if (dsecs > 0)
+		fprintf(stderr, ", %.3f Mbit/s in the last %.3f sec",
+		    (nbytes - prev) * 8 / dsecs / 1e6, dsecs);
+	fprintf(stderr, "\n");
+}
+
+static void
+livestats_dump(void)
+{
+	struct sockstats	sum;
+	uint64_t		now;
+	double			secs, dsecs;
+	int			nrunning;
+
+	nrunning = stats_snapshot(&sum);
+	now = time_ns();
+	if (sum.start_ns == 0) {
+		fprintf(stderr, "SIGUSR1: no data yet\n");
+		return;
+	}
+	secs = (now - sum.start_ns) / 1e9;
+	if (last_ns < sum.start_ns)
+		last_ns = sum.start_ns;
+	dsecs = (now - last_ns) / 1e9;
+
+	fprintf(stderr, "SIGUSR1: %.3f sec, %d running\n", secs, nrunning);
+	if (sum.tx_msgs)
+		livestats_dir(1, sum.tx_bytes, sum.tx_msgs, last_tx,
+		    secs, dsecs);
+	if (sum.rx_msgs)
+		livestats_dir(0, sum.rx_bytes, sum.rx_msgs, last_rx,
+		    secs, dsecs);
+	if (sum.tx_errors)
+		fprintf(stderr, "  %llu write errors\n",
+		    (unsigned long long) sum.tx_errors);
+	if (owd && !client)
+		owd_live();
+	if (txstamp || ackstamp)
+		txstamp_live();
+
+	last_ns = now;
+	last_tx = sum.tx_bytes;
+	last_rx = sum.rx_bytes;
+}
+
+/*
+ * SIGINT or SIGTERM:  what exit() would have done, then die of "sig".
+ */
+static void
+livestats_quit(int sig)
+{
+	sigset_t	set;
+
+	results_write();
+	shm_remove();
+	signal(sig, SIG_DFL);
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	raise(sig);
+}
+
+static void *
+livestats_thread(void *arg)
+{
+	int	sig;
+
+	(void) arg;
+	for ( ; ; ) {
+		if (sigwait(&sigs, &sig) != 0)
+			err_sys("sigwait error");
+		if (sig == SIGUSR1)
+			livestats_dump();
+		else
+			livestats_quit(sig);
+	}
+	return(NULL);
+}
+
+/*
+ * Take SIGUSR1 (and SIGINT and SIGTERM, with --results or --shm) from
+ * here on.  Call before starting any other thread.
+ */
+void
+livestats_start(void)
+{
+	pthread_t	tid;
+	int		rc;
+
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGUSR1);
+	if (resultsfile != NULL || shmname != NULL) {
+		sigaddset(&sigs, SIGINT);
+		sigaddset(&sigs, SIGTERM);
+	}
+	if ( (rc = pthread_sigmask(SIG_BLOCK, &sigs, NULL)) != 0) {
+		errno = rc;
+		err_sys("pthread_sigmask error");
+	}
+	/* a -F child has the parent's SIG_IGN, which sigwait() never sees */
+	signal(SIGUSR1, SIG_DFL);
+	if ( (rc = pthread_create(&tid, NULL, livestats_thread, NULL)) != 0) {
+		errno = rc;
+		err_sys("pthread_create error");
+	}
+	pthread_detach(tid);
+}
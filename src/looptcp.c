@@ -15,12 +15,16 @@
 
 void loop_tcp(int sockfd)
 {
-	int		maxfdp1, nread, ntowrite, stdineof, flags;
+	int		maxfdp1, n, nread, ntowrite, stdineof, flags;
+	char	       *wptr;
 	fd_set	rset;
   
 	if (pauseinit)
 		sleep_us(pauseinit*1000);	/* intended for server */
   
+	if (corkwrites || msgmore)
+		cork_init(sockfd);
+
 	flags = 0;
 	stdineof = 0;
 	FD_ZERO(&rset);
@@ -40,6 +44,8 @@ void loop_tcp(int sockfd)
 				err_sys("read error from stdin");
 			else if (nread == 0) {
 				/* EOF on stdin */
+				if (corkwrites || msgmore)
+					cork_flush(sockfd);
 				if (halfclose) {
 					if (shutdown(sockfd, SHUT_WR) < 0)
 						err_sys("shutdown() error");
@@ -53,12 +59,17 @@ void loop_tcp(int sockfd)
 	  
 			if (crlf) {
 				ntowrite = crlf_add(wbuf, writelen, rbuf, nread);
-				if (dowrite(sockfd, wbuf, ntowrite) != ntowrite)
-					err_sys("write error");
+				wptr = wbuf;
 			} else {
-				if (dowrite(sockfd, rbuf, nread) != nread)
-					err_sys("write error");
+				ntowrite = nread;
+				wptr = rbuf;
 			}
+			if (corkwrites || msgmore)	/* batched small writes */
+				n = cork_write(sockfd, NULL, 0, wptr, ntowrite);
+			else
+				n = dowrite(sockfd, wptr, ntowrite);
+			if (n != ntowrite)
+				err_sys("write error");
 		}
       
 		if (FD_ISSET(sockfd, &rset)) {
@@ -90,6 +101,11 @@ void loop_tcp(int sockfd)
 		}
 	}
   
+	if (corkwrites || msgmore)
+		cork_report(sockfd);
+	if (fastopen && client)
+		fastopen_report(sockfd);
+
 	if (pauseclose) {
 		if (verbose)
 			fprintf(stderr, "pausing before close\n");
@@ -0,0 +1,158 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Non-blocking TCP source with TCP_NOTSENT_LOWAT (--notsent-lowat n).
+ *
+ * A blocking write() can leave up to a whole SO_SNDBUF of data queued in
+ * the kernel waiting to be sent, which is latency for everything behind
+ * it.  With TCP_NOTSENT_LOWAT the socket only reports itself writable
+ * while fewer than "n" bytes are queued but not yet sent, so the source
+ * waits (in epoll_wait(), or poll() where there is no epoll) instead of
+ * piling data into the socket.  The time spent waiting is reported.
+ */
+
+#include "sock.h"
+#include <fcntl.h>
+#ifdef	HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#ifdef	HAVE_SYS_EPOLL_H
+static int	epfd = -1;
+#endif
+static uint64_t	nwaits;		/* #times the socket wasn't writable */
+static uint64_t	wait_ns;	/* total time waiting to write */
+
+/*
+ * Set TCP_NOTSENT_LOWAT and make the socket non-blocking.
+ */
+void
+lowat_init(int sockfd)
+{
+	int		flags;
+
+#ifdef	TCP_NOTSENT_LOWAT
+	{
+	int		option;
+	socklen_t	optlen;
+
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+	    &notsentlowat, sizeof(notsentlowat)) < 0)
+		err_sys("TCP_NOTSENT_LOWAT setsockopt error");
+
+	option = 0;
+	optlen = sizeof(option);
+	if (getsockopt(sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+	    &option, &optlen) < 0)
+		err_sys("TCP_NOTSENT_LOWAT getsockopt error");
+	if (verbose)
+		fprintf(stderr, "TCP_NOTSENT_LOWAT = %d\n", option);
+	}
+#else
+	err_quit("TCP_NOTSENT_LOWAT not supported by host");
+#endif
+
+	nwaits = 0;
+	wait_ns = 0;
+
+	if ( (flags = fcntl(sockfd, F_GETFL, 0)) < 0)
+		err_sys("fcntl F_GETFL error");
+	if (fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+		err_sys("fcntl F_SETFL error");
+
+#ifdef	HAVE_SYS_EPOLL_H
+	{
+	struct epoll_event	ev;
+
+	if (epfd >= 0)
+		close(epfd);	/* new connection, with --cc-compare */
+	if ( (epfd = epoll_create(1)) < 0)
+		err_sys("epoll_create error");
+	bzero(&ev, sizeof(ev));
+	ev.events = EPOLLOUT;
+	ev.data.fd = sockfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0)
+		err_sys("epoll_ctl error");
+	}
+#endif
+}
+
+/*
+ * Block until the socket is writable, and account for the time.
+ */
+static void
+lowat_wait(int sockfd)
+{
+	uint64_t	start;
+	int		n;
+
+	start = time_ns();
+	for ( ; ; ) {
+#ifdef	HAVE_SYS_EPOLL_H
+		struct epoll_event	ev;
+
+		(void) sockfd;		/* registered with epfd */
+		n = epoll_wait(epfd, &ev, 1, -1);
+#else
+		struct pollfd		pfd;
+
+		pfd.fd = sockfd;
+		pfd.events = POLLOUT;
+		n = poll(&pfd, 1, -1);
+#endif
+		stats_wait();
+		if (n > 0)
+			break;
+		if (n < 0 && errno != EINTR)
+			err_sys("wait for writable socket error");
+	}
+	wait_ns += time_ns() - start;
+	nwaits++;
+}
+
+/*
+ * Write all "nbytes", waiting for the socket to become writable as
+ * often as necessary.  Returns nbytes, or -1 on error.
+ */
+ssize_t
+lowat_write(int sockfd, const void *vptr, size_t nbytes)
+{
+	const char	*ptr;
+	size_t		 nleft;
+	ssize_t		 n;
+
+	ptr = vptr;
+	nleft = nbytes;
+	while (nleft > 0) {
+		n = write(sockfd, ptr, nleft);
+		stats_txcall(nleft, n);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return(-1);
+			lowat_wait(sockfd);
+			continue;
+		}
+		ptr += n;
+		nleft -= n;
+	}
+	return(nbytes);
+}
+
+/*
+ * Report how much of the run was spent waiting to write.
+ */
+void
+lowat_report(void)
+{
+	double	secs;
+
+	secs = (stats.end_ns - stats.start_ns) / 1e9;
+	fprintf(stderr, "waited for writable socket %llu times, %.3f sec",
+	    (unsigned long long) nwaits, wait_ns / 1e9);
+	if (secs > 0)
+		fprintf(stderr, " (%.1f%% of run)", wait_ns / 1e9 / secs * 100);
+	fprintf(stderr, "\n");
+}
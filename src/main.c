@@ -14,33 +14,56 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-#ifdef HAVE_GETOPT_H
-#include <getopt.h>
-#endif
 #include <string.h>
 #include	"sock.h"
+#include <getopt.h>		/* getopt_long() */
 
 char	*host;		/* hostname or dotted-decimal string */
 char	*port;
 
 			/* Define global variables */
+int		ackstamp;			/* TX_ACK timestamp every n writes */
 int		af_46 = AF_INET;		/* AF_INET or AF_INET6 */
 int		bindport;			/* 0 or TCP or UDP port number to bind */
 						/* set by -b or -l options */
 int		broadcast;			/* SO_BROADCAST */
+int		bufpoolmax = -1;		/* max #buffers in read buffer pool */
 int		cbreak;				/* set terminal to cbreak mode */
 int		chunkwrite;			/* write in small chunks; not all-at-once */
 int		client = 1;			/* acting as client is the default */
+char		*cclist;			/* algorithms for --cc-compare */
+char		*congestion;			/* TCP_CONGESTION algorithm */
 int		connectudp = 1;			/* connect UDP client */
+int		conntimeout;			/* ms to wait for --conns connects */
+int		corkwrites;			/* #writes per TCP_CORK group */
+int		cpsconc = 1;			/* --cps connects in flight per thread */
+int		cpsconns;			/* #connections for --cps */
+int		cpspayload;			/* bytes written per --cps connection */
+int		cpsreply;			/* bytes read per --cps connection */
+int		cpsthreads = 1;			/* #threads for --cps */
+int		cpucost;			/* --cpu: report CPU cost */
+int		cpumhz;				/* clock rate for --cpu=mhz */
+char		*cpulist;			/* --cpus: pin loops to these */
 int		crlf;				/* convert newline to CR/LF & vice versa */
 int		debug;				/* SO_DEBUG */
+char		*destlist;			/* --dests host:port list */
+int		destpolicy = DEST_WEIGHTED;	/* how flows are spread over --dests */
 int		dofork;				/* concurrent server, do a fork() */
 int		dontroute;			/* SO_DONTROUTE */
+int		fastopen;			/* TCP Fast Open; server's queue length */
 int		flowlabel_option = -1;		/* IPv6 flow label option */
 char		foreignip[INET6_ADDRSTRLEN];	/* foreign IP address, dotted-decimal string */
 int		foreignport;			/* foreign port number */
 int		halfclose;			/* TCP half close option */
+int		happyeyeballs;			/* IPv4 delay (ms) for --happy-eyeballs */
+char		*hbuf;				/* header buffer, for --iov-hdr */
 int		ignorewerr;			/* true if write() errors should be ignored */
+int		iotime;				/* --io-time: time 1 in n writes/reads */
+int		iovcnt;				/* #iovecs per writev()/readv() */
+int		iovhdrlen;			/* size of separate header iovec */
+char		*irqif;				/* --irq-cpus: pin near its IRQs */
+int		*iovsizes;			/* per-iovec sizes, malloc'ed */
+int		niovsizes;			/* #entries in iovsizes[] */
 int		ip_dontfrag = -1;		/* IPv4 DF/IPv6 don't fragment */
 int		iptos = -1;			/* IP_TOS/IPV6_TCLASS option */
 int		ipttl = -1;			/* IP_TTL/IPV6_MULTICAST_HOPS option */
@@ -50,17 +73,30 @@ char		joinip[INET6_ADDRSTRLEN];	/* multicast IP address, dotted-decimal string *
 int		keepalive;			/* SO_KEEPALIVE */
 long		linger = -1;			/* 0 or positive turns on option */
 int		listenq = 5;			/* listen queue for TCP Server */
-char		localip[32];			/* local IP address, dotted-decimal string */
+char		*localaddrs;			/* --local-addrs pool */
+char		localip[INET6_ADDRSTRLEN];	/* local IP address, dotted-decimal string */
+char		*localports;			/* --local-ports range */
+int		logdrop;			/* --log-drop: -v lines if no room */
+int		logevery;			/* --log-every: 1 in n -v lines */
+int		lograte;			/* --log-rate: -v lines/sec/thread */
 int		maxseg;				/* TCP_MAXSEG */
 int		mcastttl;			/* multicast TTL */
+int		msgmore;			/* #writes per MSG_MORE group */
 int		msgpeek;			/* MSG_PEEK */
 int		nodelay;			/* TCP_NODELAY (Nagle algorithm) */
+int		nconns;				/* #parallel connections for --conns */
 int		nbuf = 1024;			/* number of buffers to write (sink mode) */
+int		numabind;			/* --numa: memory on the CPU's node */
+int		notsentlowat;			/* TCP_NOTSENT_LOWAT, non-blocking source */
+int		owd;				/* UDP one-way delay */
 int		onesbcast;			/* set IP_ONESBCAST for 255.255.255.255 bcasts */
 int		pauseclose;			/* #ms to sleep after recv FIN, before close */
 int		pauseinit;			/* #ms to sleep before first read */
 int		pauselisten;			/* #ms to sleep after listen() */
 int		pauserw;			/* #ms to sleep before each read or write */
+int		perfevents;			/* --perf: perf_event counters */
+int		resultscsv;			/* --results as CSV, not JSON */
+char		*resultsfile;			/* machine-readable results file */
 int		reuseaddr;			/* SO_REUSEADDR */
 int		reuseport;			/* SO_REUSEPORT */
 int		readlen = 1024;			/* default read length for socket */
@@ -75,9 +111,16 @@ int		sroute_option = 0;		/* set if -g or -G specified */
 char   		*rbuf;				/* pointer that is malloc'ed */
 char   		*wbuf;				/* pointer that is malloc'ed */
 int		server;				/* to act as server requires -s option */
+int		sampleint;			/* #ms between TCP_INFO samples */
+int		samplebin;			/* binary time series */
+char		*samplefile;			/* time series output file */
+char		*shmname;			/* --shm segment ("" = default) */
+int		shmread;			/* --shm-read */
 int		sigio;				/* send SIGIO */
 int		sourcesink;			/* source/sink mode */
 int		l4_prot = L4_PROT_TCP;		/* TCP or UDP or SCTP */
+int		timestamp;			/* send time at start of each write */
+int		txstamp;			/* SO_TIMESTAMPING transmit stamps */
 int		urgwrite;			/* write urgent byte after this write */
 int		verbose;			/* each -v increments this by 1 */
 int		usewritev;			/* use writev() instead of write() */
@@ -85,8 +128,105 @@ int		usewritev;			/* use writev() instead of write() */
 struct sockaddr_in	cliaddr4, servaddr4;
 struct sockaddr_in6	cliaddr6, servaddr6;
 
+static void	parse_iovsizes(char *);
 static void	usage(const char *);
 
+/*
+ * Long options.  Nearly all of the single-character options are taken,
+ * so newer options only have a long form.  Their values start above
+ * any single character that getopt_long() can return.
+ */
+enum {
+	OPT_ACKSTAMP = 256,
+	OPT_BUFPOOL,
+	OPT_CC_COMPARE,
+	OPT_CONGESTION,
+	OPT_CONNECT_TIMEOUT,
+	OPT_CONNS,
+	OPT_CORK,
+	OPT_CPS,
+	OPT_CPS_CONC,
+	OPT_CPS_PAYLOAD,
+	OPT_CPS_REPLY,
+	OPT_CPS_THREADS,
+	OPT_CPU,
+	OPT_CPUS,
+	OPT_DEST_POLICY,
+	OPT_DESTS,
+	OPT_FASTOPEN,
+	OPT_HAPPY_EYEBALLS,
+	OPT_IO_TIME,
+	OPT_IOV,
+	OPT_IOV_HDR,
+	OPT_IOV_SIZES,
+	OPT_IRQ_CPUS,
+	OPT_LOCAL_ADDRS,
+	OPT_LOCAL_PORTS,
+	OPT_LOG_DROP,
+	OPT_LOG_EVERY,
+	OPT_LOG_RATE,
+	OPT_MSG_MORE,
+	OPT_NOTSENT_LOWAT,
+	OPT_NUMA,
+	OPT_OWD,
+	OPT_PERF,
+	OPT_RESULTS,
+	OPT_RESULTS_FORMAT,
+	OPT_SAMPLE,
+	OPT_SAMPLE_BIN,
+	OPT_SAMPLE_FILE,
+	OPT_SHM,
+	OPT_SHM_READ,
+	OPT_TIMESTAMP,
+	OPT_TXSTAMP,
+};
+
+static struct option	longopts[] = {
+	{ "ackstamp",	required_argument,	NULL,	OPT_ACKSTAMP },
+	{ "bufpool",	required_argument,	NULL,	OPT_BUFPOOL },
+	{ "cc-compare",	required_argument,	NULL,	OPT_CC_COMPARE },
+	{ "congestion",	required_argument,	NULL,	OPT_CONGESTION },
+	{ "connect-timeout", required_argument,	NULL,	OPT_CONNECT_TIMEOUT },
+	{ "conns",	required_argument,	NULL,	OPT_CONNS },
+	{ "cork",	required_argument,	NULL,	OPT_CORK },
+	{ "cps",	required_argument,	NULL,	OPT_CPS },
+	{ "cps-conc",	required_argument,	NULL,	OPT_CPS_CONC },
+	{ "cps-payload", required_argument,	NULL,	OPT_CPS_PAYLOAD },
+	{ "cps-reply",	required_argument,	NULL,	OPT_CPS_REPLY },
+	{ "cps-threads", required_argument,	NULL,	OPT_CPS_THREADS },
+	{ "cpu",	optional_argument,	NULL,	OPT_CPU },
+	{ "cpus",	required_argument,	NULL,	OPT_CPUS },
+	{ "dest-policy", required_argument,	NULL,	OPT_DEST_POLICY },
+	{ "dests",	required_argument,	NULL,	OPT_DESTS },
+	{ "fastopen",	optional_argument,	NULL,	OPT_FASTOPEN },
+	{ "happy-eyeballs", optional_argument,	NULL,	OPT_HAPPY_EYEBALLS },
+	{ "io-time",	required_argument,	NULL,	OPT_IO_TIME },
+	{ "iov",	required_argument,	NULL,	OPT_IOV },
+	{ "iov-hdr",	required_argument,	NULL,	OPT_IOV_HDR },
+	{ "iov-sizes",	required_argument,	NULL,	OPT_IOV_SIZES },
+	{ "irq-cpus",	required_argument,	NULL,	OPT_IRQ_CPUS },
+	{ "local-addrs", required_argument,	NULL,	OPT_LOCAL_ADDRS },
+	{ "local-ports", required_argument,	NULL,	OPT_LOCAL_PORTS },
+	{ "log-drop",	no_argument,		NULL,	OPT_LOG_DROP },
+	{ "log-every",	required_argument,	NULL,	OPT_LOG_EVERY },
+	{ "log-rate",	required_argument,	NULL,	OPT_LOG_RATE },
+	{ "msg-more",	required_argument,	NULL,	OPT_MSG_MORE },
+	{ "notsent-lowat", required_argument,	NULL,	OPT_NOTSENT_LOWAT },
+	{ "numa",	no_argument,		NULL,	OPT_NUMA },
+	{ "owd",	no_argument,		NULL,	OPT_OWD },
+	{ "perf",	no_argument,		NULL,	OPT_PERF },
+	{ "results",	required_argument,	NULL,	OPT_RESULTS },
+	{ "results-format", required_argument,	NULL,	OPT_RESULTS_FORMAT },
+	{ "sample",	required_argument,	NULL,	OPT_SAMPLE },
+	{ "sample-bin",	no_argument,		NULL,	OPT_SAMPLE_BIN },
+	{ "sample-file", required_argument,	NULL,	OPT_SAMPLE_FILE },
+	{ "shm",	optional_argument,	NULL,	OPT_SHM },
+	{ "shm-read",	no_argument,		NULL,	OPT_SHM_READ },
+	{ "timestamp",	no_argument,		NULL,	OPT_TIMESTAMP },
+	{ "txstamp",	no_argument,		NULL,	OPT_TXSTAMP },
+	{ NULL,		0,			NULL,	0 }
+};
+
 int
 main(int argc, char *argv[])
 {
@@ -97,7 +237,7 @@ main(int argc, char *argv[])
 		usage("");
 
 	opterr = 0;		/* don't want getopt() writing to stderr */
-	while ( (c = getopt(argc, argv, "01:2569:b:cde:f:g:hij:kl:n:op:q:r:st:uvw:x:y:ABCDEFG:H:IJ:KL:NO:P:Q:R:S:TU:VWX:YZ")) != -1) {
+	while ( (c = getopt_long(argc, argv, "01:2569:b:cde:f:g:hij:kl:n:op:q:r:st:uvw:x:y:ABCDEFG:H:IJ:KL:NO:P:Q:R:S:TU:VWX:YZ", longopts, NULL)) != -1) {
 		switch (c) {
 		case '0':			/* print version string */
 			printf("sock:  version %s\n", VERSION);
@@ -179,6 +319,8 @@ main(int argc, char *argv[])
 
 			*ptr++ = 0;		/* NUL replaces final period */
 			bindport = atoi(ptr);	 /* port number */
+			if (strlen(optarg) >= sizeof(localip))
+				usage("invalid -l option");
 			strcpy(localip, optarg); /* save dotted-decimal IP */
 			break;
 
@@ -343,11 +485,225 @@ main(int argc, char *argv[])
 			msgpeek = MSG_PEEK;
 			break;
 
+		case OPT_ACKSTAMP:		/* write-to-ACK latency */
+			if ( (ackstamp = atoi(optarg)) <= 0)
+				usage("invalid --ackstamp option");
+			break;
+
+		case OPT_BUFPOOL:		/* borrow read buffers from a pool */
+			bufpoolmax = atoi(optarg);
+			break;
+
+		case OPT_CC_COMPARE:		/* rerun under each algorithm */
+			cclist = optarg;
+			break;
+
+		case OPT_CONGESTION:		/* TCP_CONGESTION */
+			congestion = optarg;
+			break;
+
+		case OPT_CONNECT_TIMEOUT:	/* give up on --conns connects */
+			if ( (conntimeout = atoi(optarg)) <= 0)
+				usage("invalid --connect-timeout option");
+			break;
+
+		case OPT_CONNS:			/* parallel connections */
+			if ( (nconns = atoi(optarg)) <= 0)
+				usage("invalid --conns option");
+			break;
+
+		case OPT_CORK:			/* TCP_CORK around n writes */
+			if ( (corkwrites = atoi(optarg)) <= 0)
+				usage("invalid --cork option");
+			break;
+
+		case OPT_CPS:			/* connection rate benchmark */
+			if ( (cpsconns = atoi(optarg)) <= 0)
+				usage("invalid --cps option");
+			break;
+
+		case OPT_CPS_CONC:
+			if ( (cpsconc = atoi(optarg)) <= 0)
+				usage("invalid --cps-conc option");
+			break;
+
+		case OPT_CPS_PAYLOAD:
+			if ( (cpspayload = atoi(optarg)) < 0)
+				usage("invalid --cps-payload option");
+			break;
+
+		case OPT_CPS_REPLY:
+			if ( (cpsreply = atoi(optarg)) < 0)
+				usage("invalid --cps-reply option");
+			break;
+
+		case OPT_CPS_THREADS:
+			if ( (cpsthreads = atoi(optarg)) <= 0)
+				usage("invalid --cps-threads option");
+			break;
+
+		case OPT_CPU:			/* CPU cost, cycles per byte */
+			cpucost = 1;
+			if (optarg != NULL && (cpumhz = atoi(optarg)) <= 0)
+				usage("invalid --cpu option");
+			break;
+
+		case OPT_CPUS:			/* pin the loops to these CPUs */
+			cpulist = optarg;
+			break;
+
+		case OPT_DEST_POLICY:		/* rr, weighted or hash */
+			if (strcmp(optarg, "rr") == 0)
+				destpolicy = DEST_RR;
+			else if (strcmp(optarg, "weighted") == 0)
+				destpolicy = DEST_WEIGHTED;
+			else if (strcmp(optarg, "hash") == 0)
+				destpolicy = DEST_HASH;
+			else
+				usage("invalid --dest-policy option");
+			break;
+
+		case OPT_DESTS:			/* fan out to several servers */
+			destlist = optarg;
+			break;
+
+		case OPT_FASTOPEN:		/* TCP Fast Open */
+			fastopen = (optarg != NULL) ? atoi(optarg) : 16;
+			if (fastopen <= 0)
+				usage("invalid --fastopen option");
+			break;
+
+		case OPT_HAPPY_EYEBALLS:	/* race IPv6 and IPv4 connects */
+			happyeyeballs = (optarg != NULL) ? atoi(optarg) : 250;
+			if (happyeyeballs <= 0)
+				usage("invalid --happy-eyeballs option");
+			break;
+
+		case OPT_IO_TIME:		/* time 1 in n writes or reads */
+			if ( (iotime = atoi(optarg)) <= 0)
+				usage("invalid --io-time option");
+			break;
+
+		case OPT_IOV:			/* #iovecs per writev()/readv() */
+			if ( (iovcnt = atoi(optarg)) <= 0)
+				usage("invalid --iov option");
+			usewritev = 1;
+			chunkwrite = 1;	/* implies -V and -k too */
+			break;
+
+		case OPT_IOV_HDR:		/* separate header iovec */
+			if ( (iovhdrlen = atoi(optarg)) <= 0)
+				usage("invalid --iov-hdr option");
+			usewritev = 1;
+			chunkwrite = 1;
+			break;
+
+		case OPT_IOV_SIZES:		/* per-iovec sizes: n,n,... */
+			parse_iovsizes(optarg);
+			usewritev = 1;
+			chunkwrite = 1;
+			break;
+
+		case OPT_IRQ_CPUS:		/* pin near the NIC's interrupts */
+			irqif = optarg;
+			break;
+
+		case OPT_LOCAL_ADDRS:		/* pool of local addresses */
+			localaddrs = optarg;
+			break;
+
+		case OPT_LOCAL_PORTS:		/* and ports */
+			localports = optarg;
+			break;
+
+		case OPT_LOG_DROP:		/* rather than wait for room */
+			logdrop = 1;
+			break;
+
+		case OPT_LOG_EVERY:		/* sample the -v lines */
+			if ( (logevery = atoi(optarg)) <= 0)
+				usage("invalid --log-every option");
+			break;
+
+		case OPT_LOG_RATE:		/* and limit them */
+			if ( (lograte = atoi(optarg)) <= 0)
+				usage("invalid --log-rate option");
+			break;
+
+		case OPT_MSG_MORE:		/* MSG_MORE on n-1 of n writes */
+			if ( (msgmore = atoi(optarg)) <= 0)
+				usage("invalid --msg-more option");
+			break;
+
+		case OPT_NOTSENT_LOWAT:		/* non-blocking, TCP_NOTSENT_LOWAT */
+			if ( (notsentlowat = atoi(optarg)) <= 0)
+				usage("invalid --notsent-lowat option");
+			break;
+
+		case OPT_NUMA:			/* memory on the pinned CPU's node */
+			numabind = 1;
+			break;
+
+		case OPT_OWD:			/* UDP one-way delay */
+			owd = 1;
+			break;
+
+		case OPT_PERF:			/* cycles, IPC, cache misses */
+			perfevents = 1;
+			break;
+
+		case OPT_RESULTS:		/* machine-readable results */
+			resultsfile = optarg;
+			break;
+
+		case OPT_RESULTS_FORMAT:	/* json or csv */
+			if (strcmp(optarg, "csv") == 0)
+				resultscsv = 1;
+			else if (strcmp(optarg, "json") == 0)
+				resultscsv = 0;
+			else
+				usage("invalid --results-format option");
+			break;
+
+		case OPT_SAMPLE:		/* TCP_INFO time series */
+			if ( (sampleint = atoi(optarg)) <= 0)
+				usage("invalid --sample option");
+			break;
+
+		case OPT_SAMPLE_BIN:
+			samplebin = 1;
+			break;
+
+		case OPT_SAMPLE_FILE:
+			samplefile = optarg;
+			break;
+
+		case OPT_SHM:			/* counters in shared memory */
+			shmname = (optarg != NULL) ? optarg : "";
+			break;
+
+		case OPT_SHM_READ:		/* print them */
+			shmread = 1;
+			break;
+
+		case OPT_TIMESTAMP:		/* timestamped payload */
+			timestamp = 1;
+			break;
+
+		case OPT_TXSTAMP:		/* transmit timestamps */
+			txstamp = 1;
+			break;
+
 		case '?':
 			usage("unrecognized option");
 		}
 	}
 
+	if (shmread) {			/* monitor, not a test */
+		shm_read(argc - optind, argv + optind);
+		exit(0);
+	}
+
 	/* check for options that don't make sense */
 	if ((AF_INET6 == af_46) && sroute_option) {
 		usage("can't specify -g or -G with IPv6");
@@ -367,6 +723,121 @@ main(int argc, char *argv[])
 		usage("can't specify -L with -u or -5");
 	if (l4_prot != L4_PROT_TCP && nodelay)
 		usage("can't specify -N with -u or -5");
+	if (l4_prot != L4_PROT_TCP && (corkwrites || msgmore))
+		usage("can't specify --cork or --msg-more with -u or -5");
+	if (corkwrites && msgmore)
+		usage("can't specify both --cork and --msg-more");
+	if (congestion != NULL && l4_prot != L4_PROT_TCP)
+		usage("can't specify --congestion with -u or -5");
+	if (cclist != NULL && (l4_prot != L4_PROT_TCP || !sourcesink || !client))
+		usage("--cc-compare is only for a TCP \"source\" client");
+	if (cclist != NULL && congestion != NULL)
+		usage("can't specify both --congestion and --cc-compare");
+	if (localaddrs != NULL && (!client || bindport || localip[0]))
+		usage("--local-addrs is only for a client, without -b or -l");
+	if (localports != NULL && localaddrs == NULL)
+		usage("--local-ports needs --local-addrs");
+	if (happyeyeballs && (l4_prot == L4_PROT_UDP || !client ||
+	    af_46 == AF_INET6))
+		usage("--happy-eyeballs is only for a TCP or SCTP client, "
+		    "without -6");
+	if (happyeyeballs && (cpsconns || nconns || fastopen || bindport ||
+	    localip[0] || localaddrs != NULL))
+		usage("can't specify --happy-eyeballs with --cps, --conns, "
+		    "--fastopen, -b, -l or --local-addrs");
+	if (fastopen && l4_prot != L4_PROT_TCP)
+		usage("can't specify --fastopen with -u or -5");
+	if ((nconns || destlist != NULL) && (!sourcesink || !connectudp))
+		usage("--conns and --dests are only for a \"source\" client "
+		    "or \"sink\" server, without -o");
+	if (nconns && !client && (l4_prot == L4_PROT_UDP || dofork))
+		usage("--conns for a \"sink\" server is only for TCP or SCTP, "
+		    "without -F");
+	if (destlist != NULL && !client)
+		usage("--dests is only for a \"source\" client");
+	if (destlist != NULL && (cpsconns || happyeyeballs))
+		usage("can't specify --dests with --cps or --happy-eyeballs");
+	if ((nconns || destlist != NULL) && (cclist != NULL || cpsconns ||
+	    sampleint || timestamp || txstamp || ackstamp || notsentlowat ||
+	    corkwrites || msgmore))
+		usage("can't specify --conns or --dests with --cc-compare, --cps, "
+		    "--sample, --timestamp, --txstamp, --ackstamp, "
+		    "--notsent-lowat, --cork or --msg-more");
+	if (conntimeout && !nconns && destlist == NULL)
+		usage("--connect-timeout needs --conns or --dests");
+	if (cpsconns && (l4_prot == L4_PROT_UDP || !client))
+		usage("--cps is only for a TCP or SCTP client");
+	if (cpsconns && (cclist != NULL || sampleint || txstamp || ackstamp))
+		usage("can't specify --cps with --cc-compare, --sample, "
+		    "--txstamp or --ackstamp");
+	if ((cpsconc > 1 || cpsthreads > 1 || cpspayload || cpsreply) &&
+	    !cpsconns)
+		usage("--cps-conc, --cps-payload, --cps-reply and --cps-threads "
+		    "need --cps");
+	if (cpsconns && fastopen && cpspayload == 0)
+		usage("--fastopen with --cps needs --cps-payload, to go with "
+		    "the SYN");
+	if (notsentlowat && (l4_prot != L4_PROT_TCP || !sourcesink || !client))
+		usage("--notsent-lowat is only for a TCP \"source\" client");
+	if (notsentlowat && (chunkwrite || corkwrites || msgmore))
+		usage("can't specify --notsent-lowat with -k, -V, --iov*, "
+		    "--cork or --msg-more");
+	if (sampleint && (l4_prot == L4_PROT_UDP || !sourcesink))
+		usage("--sample is only for a TCP or SCTP \"source\" or \"sink\"");
+	if (sampleint && cclist != NULL)
+		usage("can't specify both --sample and --cc-compare");
+	if ((samplebin || samplefile != NULL) && !sampleint)
+		usage("--sample-bin and --sample-file need --sample");
+	if (samplebin && samplefile == NULL)
+		usage("--sample-bin needs --sample-file");
+	if (shmname != NULL && (!sourcesink || cclist != NULL || cpsconns))
+		usage("--shm is only for a \"source\" or \"sink\", without "
+		    "--cc-compare or --cps");
+	if (cpucost && (!sourcesink || cclist != NULL || cpsconns))
+		usage("--cpu is only for a \"source\" or \"sink\", without "
+		    "--cc-compare or --cps");
+	if (perfevents && (!sourcesink || cclist != NULL || cpsconns))
+		usage("--perf is only for a \"source\" or \"sink\", without "
+		    "--cc-compare or --cps");
+	if (cpulist != NULL && irqif != NULL)
+		usage("can't specify both --cpus and --irq-cpus");
+	if ((cpulist != NULL || irqif != NULL) && !sourcesink && !cpsconns)
+		usage("--cpus and --irq-cpus are only for a \"source\" or "
+		    "\"sink\" or --cps");
+	if (numabind && cpulist == NULL && irqif == NULL)
+		usage("--numa needs --cpus or --irq-cpus");
+	if ((logdrop || logevery || lograte) && (!verbose || !sourcesink))
+		usage("--log-drop, --log-every and --log-rate need -v and -i");
+	if (iotime && (!sourcesink || cclist != NULL || cpsconns))
+		usage("--io-time is only for a \"source\" or \"sink\", without "
+		    "--cc-compare or --cps");
+	if (resultscsv && resultsfile == NULL)
+		usage("--results-format needs --results");
+	if (owd && (l4_prot != L4_PROT_UDP || !sourcesink))
+		usage("--owd is only for a UDP \"source\" or \"sink\"");
+	if (owd && (!connectudp || usewritev || msgpeek || timestamp))
+		usage("can't specify --owd with -o, -V, --iov*, -Z or "
+		    "--timestamp");
+	if (owd && client && writelen < TSTAMP_LEN)
+		usage("--owd needs -w of at least 16");
+	if (txstamp && (l4_prot == L4_PROT_SCTP || !sourcesink || !client))
+		usage("--txstamp is only for a TCP or UDP \"source\" client");
+	if (txstamp && (chunkwrite || !connectudp || corkwrites || msgmore ||
+	    notsentlowat))
+		usage("can't specify --txstamp with -k, -V, --iov*, -o, "
+		    "--cork, --msg-more or --notsent-lowat");
+	if (ackstamp && (l4_prot != L4_PROT_TCP || !sourcesink || !client))
+		usage("--ackstamp is only for a TCP \"source\" client");
+	if (ackstamp && (chunkwrite || corkwrites || msgmore || notsentlowat))
+		usage("can't specify --ackstamp with -k, -V, --iov*, "
+		    "--cork, --msg-more or --notsent-lowat");
+	if (timestamp && (!sourcesink || iovhdrlen))
+		usage("--timestamp needs -i, and can't be used with --iov-hdr");
+	if (timestamp && writelen < TSTAMP_LEN)	/* the sink's record length */
+		usage("--timestamp needs -w of at least 16");
+	if (urgwrite && (timestamp || txstamp || ackstamp))
+		usage("can't specify -U with --timestamp, --txstamp or "
+		    "--ackstamp");	/* the urgent byte shifts what's stamped */
 #ifdef	notdef
 	if (l4_prot == L4_PROT_TCP && broadcast)
 		usage("can't specify -B with TCP");
@@ -374,8 +845,16 @@ main(int argc, char *argv[])
 	if ((L4_PROT_UDP != l4_prot) && (0 != foreignip[0])) {
 		usage("can't specify -f with TCP or SCTP");
 	}
-
-	if (client) {
+	if ((L4_PROT_UDP == l4_prot) && !connectudp && usewritev && sourcesink)
+		usage("can't specify -V or --iov* with -o for UDP source");
+	if (iov_count() + (iovhdrlen != 0) > iov_max())
+		err_quit("too many iovecs: at most %d per writev()", iov_max());
+
+	if (client && destlist != NULL) {
+		if (optind != argc)
+			usage("can't give <hostname> and <port> with --dests");
+		host = port = NULL;
+	} else if (client) {
 		if (optind != argc-2)
 			usage("missing <hostname> and/or <port>");
 		host = argv[optind];
@@ -396,11 +875,69 @@ main(int argc, char *argv[])
 		}
 	}
 
+	results_init(host, port);	/* written at exit */
+	if (cpulist != NULL || irqif != NULL)
+		affinity_init();	/* before any buffer is allocated */
+	if (bufpoolmax >= 0)
+		bufpool_init(readlen, bufpoolmax);
+	if (localaddrs != NULL)
+		srcpool_init(localaddrs, localports);
+
+	if (cclist != NULL) {
+		cc_compare(host, port);		/* one run per algorithm */
+		exit(0);
+	}
+
+	if (cpsconns) {
+		cps_run(host, port);		/* many short connections */
+		exit(0);
+	}
+
+	if (destlist != NULL) {
+		fanout_init(destlist);
+		if (nconns == 0)
+			nconns = fanout_flows();	/* one per unit of weight */
+	}
+	if (nconns) {
+		shm_init(nconns, host, port);	/* with --shm */
+		if (cpucost)
+			cpu_start();
+		if (perfevents)
+			perf_init();		/* before the threads */
+		livestats_start();		/* SIGUSR1 dumps the counters */
+		if (verbose)
+			vlog_start();		/* -v off the data path */
+		if (client)
+			conn_run(host, port);	/* one source thread each */
+		else
+			conn_serve(servopen(host, port));	/* one sink each */
+		stats_report();
+		if (bufpoolmax >= 0)
+			bufpool_report();
+		exit(0);
+	}
+
 	if (client)
 		fd = cliopen(host, port);
 	else
 		fd = servopen(host, port);
 
+	results_sockopts(fd);
+	if (sourcesink) {
+		shm_init(1, host, port);	/* with --shm */
+		if (cpucost)
+			cpu_start();
+		if (perfevents)
+			perf_init();
+		livestats_start();	/* before any other thread */
+		if (verbose)
+			vlog_start();	/* -v off the data path */
+	}
+	if (owd && client)
+		timestamp = 1;		/* --owd source stamps each datagram */
+	if (sampleint)
+		sampler_start(fd);	/* stopped before close() */
+
 	if (sourcesink) {		/* ignore stdin/stdout */
 		if (client) {
 			if (l4_prot == L4_PROT_UDP) {
@@ -429,9 +966,41 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if (verbose || usewritev || ackstamp || iotime || cpucost ||
+	    perfevents || cpulist != NULL || irqif != NULL)
+		stats_report();
+	if (timestamp)
+		tstamp_report();
+	if (owd && !client)
+		owd_report();
+	if (bufpoolmax >= 0)
+		bufpool_report();
+
 	exit(0);
 }
 
+/*
+ * Parse the comma-separated list of iovec sizes for --iov-sizes.
+ */
+static void
+parse_iovsizes(char *arg)
+{
+	char	*ptr;
+	int	 n;
+
+	niovsizes = 0;
+	for (ptr = strtok(arg, ","); ptr != NULL; ptr = strtok(NULL, ",")) {
+		if ( (n = atoi(ptr)) <= 0)
+			usage("invalid --iov-sizes option");
+		if ( (iovsizes = realloc(iovsizes,
+		    (niovsizes + 1) * sizeof(int))) == NULL)
+			err_sys("realloc error for --iov-sizes");
+		iovsizes[niovsizes++] = n;
+	}
+	if (niovsizes == 0)
+		usage("invalid --iov-sizes option");
+}
+
 static void
 usage(const char *msg)
 {
@@ -439,7 +1008,9 @@ usage(const char *msg)
 "usage: sock [ options ] <host> <port>              (for client; default)\n"
 "       sock [ options ] -s [ <IPaddr> ] <port>     (for server)\n"
 "       sock [ options ] -i <host> <port>           (for \"source\" client)\n"
+"       sock [ options ] -i --dests <host>:<port>,...  (for fan-out)\n"
 "       sock [ options ] -i -s [ <IPaddr> ] <port>  (for \"sink\" server)\n"
+"       sock [ -v ] --shm-read [ <name> ... ]       (print --shm counters)\n"
 "options: -b n  bind n as client's local port number\n"
 "         -c    convert newline to CR/LF & vice versa\n"
 "         -e n  enable (n=1) or disable (n=0) IPv6 header flow label\n"
@@ -452,6 +1023,7 @@ usage(const char *msg)
 #endif
 "         -k    write or writev in chunks\n"
 "         -l a.b.c.d.p  client's local IP address = a.b.c.d, local port# = p\n"
+"                      (an IPv6 address with -6, e.g. ::1.5000)\n"
 "         -n n  #buffers to write for \"source\" client (default 1024)\n"
 "         -o    do NOT connect UDP client\n"
 "         -p n  #ms to pause before each read or write (source/sink)\n"
@@ -493,7 +1065,8 @@ usage(const char *msg)
 "         -T    SO_REUSEPORT option\n"
 #endif
 "         -U n  enter urgent mode before write number n (source only)\n"
-"         -V    use writev() instead of write(); enables -k too\n"
+"         -V    use writev() instead of write() (readv() for \"sink\");\n"
+"               enables -k too\n"
 "         -W    ignore write errors for sink client\n"
 "         -X n  TCP_MAXSEG option (set MSS)\n"
 "         -Y    SO_DONTROUTE option\n"
@@ -506,6 +1079,105 @@ usage(const char *msg)
 "         -5    use SCTP instead of TCP or UDP\n"
 "         -6    use IPv6 instead of IPv4\n"
 "         -9 n  IPv6:  specify # of destination options extension headers\n"
+"long options:\n"
+"         --ackstamp n  TX_ACK timestamp on every n'th write; reports\n"
+"                      write-to-ACK latency (TCP source)\n"
+"         --bufpool n  sink borrows a buffer per read from a pool of at most\n"
+"                      n buffers (0 = no limit); reports the pool's\n"
+"                      high-water mark (see --conns)\n"
+"         --cc-compare a,b,...  run the TCP source once under each of these\n"
+"                      congestion control algorithms and print a table of\n"
+"                      throughput, retransmits and RTT (sink needs -F)\n"
+"         --congestion a  TCP_CONGESTION option (algorithm name)\n"
+"         --connect-timeout ms  give up on --conns connects not\n"
+"                      established after ms milliseconds\n"
+"         --conns n    open n connections at once (non-blocking connects)\n"
+"                      and run the source on each in its own thread;\n"
+"                      reports handshake times and the total throughput.\n"
+"                      For the TCP or SCTP sink, accept n connections and\n"
+"                      run the sink on each in its own thread\n"
+"         --cork n     TCP_CORK each group of n writes, then uncork; reports\n"
+"                      data segments sent per write (TCP source and loop)\n"
+"         --cps n      connection rate benchmark:  make n connections, each\n"
+"                      closed straight away (abortively with -L 0); reports\n"
+"                      connections/sec, connect time and failures by errno\n"
+"         --cps-conc n  non-blocking connects in flight per thread\n"
+"         --cps-payload n  write n bytes on each --cps connection\n"
+"         --cps-reply n  then read n bytes back before closing\n"
+"         --cps-threads n  number of --cps threads\n"
+"         --cpu[=mhz]  report the CPU time of the source or sink, cycles\n"
+"                      per byte and per write or read (at mhz, default\n"
+"                      as the host says), and each busy core's user, sys,\n"
+"                      irq and softirq time and NET_RX/NET_TX softirqs\n"
+"         --cpus list  pin each source or sink thread (--conns, -F, --cps)\n"
+"                      to the next CPU of list, e.g. 0-3,8; reports where\n"
+"                      each ran\n"
+"         --dests h:p[/w],...  spread the source's flows (--conns, or one\n"
+"                      per unit of weight w) over these servers, all IPv4\n"
+"                      or all IPv6 (-6); reports throughput and errors per\n"
+"                      server\n"
+"         --dest-policy p  how:  rr, weighted (default) or hash (of the\n"
+"                      local address and port)\n"
+"         --fastopen[=n]  TCP Fast Open:  the client's first write goes\n"
+"                      with the SYN (TCP_FASTOPEN_CONNECT, or MSG_FASTOPEN\n"
+"                      with --cps and --cps-payload); the server allows\n"
+"                      n pending TFO connections (default 16); reports\n"
+"                      TFO use\n"
+"         --happy-eyeballs[=ms]  look up both IPv6 and IPv4 addresses and\n"
+"                      race the connects, IPv4 starting ms (default 250)\n"
+"                      after IPv6; reports which family won, by how much\n"
+"         --io-time n  time 1 in n writes or reads:  a histogram of the time\n"
+"                      in each, and the run split into time in write or\n"
+"                      read, pacing sleeps and our own work\n"
+"         --iov n      writev()/readv() with n iovecs (up to IOV_MAX); enables -V\n"
+"         --iov-hdr n  writev()/readv() an n-byte header from a separate buffer\n"
+"                      ahead of the data; enables -V\n"
+"         --iov-sizes n,n,...  writev()/readv() with iovecs of these sizes;\n"
+"                      the last one gets the rest of the data; enables -V\n"
+"         --irq-cpus if  like --cpus, with the CPUs on the NUMA node of\n"
+"                      interface if's interrupts, but not those taking them\n"
+"         --local-addrs a,b-c,...  bind each client socket to the next\n"
+"                      of these local addresses or ranges (IPv4, or IPv6\n"
+"                      with -6), leaving the port to connect() with\n"
+"                      IP_BIND_ADDRESS_NO_PORT\n"
+"         --local-ports lo-hi  bind the --local-addrs to these ports too\n"
+"         --log-drop   with -v, drop lines when a thread's queue is full,\n"
+"                      rather than wait for it to be written; says how\n"
+"                      many were dropped\n"
+"         --log-every n  with -v, log only every nth line of each source\n"
+"                      or sink thread\n"
+"         --log-rate n  with -v, log at most n lines per second per thread;\n"
+"                      says how many were left out\n"
+"         --msg-more n  send n-1 of every n writes with MSG_MORE; reports\n"
+"                      data segments sent per write (TCP source and loop)\n"
+"         --notsent-lowat n  non-blocking TCP source that keeps at most n\n"
+"                      unsent bytes queued (TCP_NOTSENT_LOWAT); reports\n"
+"                      time spent waiting to write\n"
+"         --numa       with --cpus or --irq-cpus, allocate each thread's\n"
+"                      memory on the node of its CPU (set_mempolicy)\n"
+"         --owd        UDP one-way delay from kernel receive timestamps, with\n"
+"                      clock offset estimation; histogram and jitter\n"
+"         --perf       count cycles, instructions, cache and branch misses\n"
+"                      and context switches in the source or sink threads\n"
+"                      (perf_event_open); totals, per byte and per write\n"
+"         --results f  also write the configuration, the socket options\n"
+"                      in effect, the --sample series, per-connection and\n"
+"                      total counters to file f at exit (or on SIGINT or\n"
+"                      SIGTERM)\n"
+"         --results-format fmt  json (default) or csv\n"
+"         --sample ms  read TCP_INFO (SCTP_STATUS with -5) every ms\n"
+"                      milliseconds on a separate thread, and write the\n"
+"                      time series as CSV at the end (source and sink)\n"
+"         --sample-bin  write the time series in binary\n"
+"         --sample-file f  write the time series to file f, not stderr\n"
+"         --shm[=name]  keep live counters in shared memory segment name\n"
+"                      (default /sock.<pid>), for --shm-read\n"
+"         --shm-read   print the counters of these (default all /sock.*)\n"
+"                      segments, and the totals; per stream with -v\n"
+"         --timestamp  source:  put sequence# and send time at the start of\n"
+"                      each write; sink:  report delay (needs source's -w)\n"
+"         --txstamp    report time from write to qdisc to driver, from\n"
+"                      SO_TIMESTAMPING transmit timestamps (TCP/UDP source)\n"
 );
 
 	if (msg[0] != 0)
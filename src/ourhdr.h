@@ -106,6 +106,8 @@ void	err_msg(const char *, ...);
 void	err_quit(const char *, ...);
 void	err_ret(const char *, ...);
 void	err_sys(const char *, ...);
+int	vlog_put(const char *);		/* vlog.c, for err_doit() */
+void	vlog_flush(void);
 
 void	log_msg(const char *, ...);		/* {App misc_source} */
 void	log_open(const char *, int, int);
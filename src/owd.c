@@ -0,0 +1,321 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * UDP one-way delay, with --owd.  The source puts a sequence number and
+ * its send time at the start of each datagram (as with --timestamp).
+ * The sink takes the receive time from the kernel with SO_TIMESTAMPING
+ * (a hardware timestamp when the NIC gives one, else the software one
+ * taken when the packet reached the stack; SO_TIMESTAMP on hosts without
+ * SO_TIMESTAMPING), so that it doesn't include the sink's scheduling
+ * delay.  Delays go into a histogram, and RFC 3550 interarrival jitter,
+ * loss and reordering are counted from the sequence numbers.
+ *
+ * For source and sink on different hosts, the source first estimates
+ * the offset between the two clocks, NTP-style:  it sends OWD_PROBES
+ * probes, the sink answers each with its receive and reply times, and
+ * the offset from the probe with the smallest round trip is sent to
+ * the sink, which applies it to every delay.  The error of the estimate
+ * is at most half that round trip.  The source ends with a few copies
+ * of an end-of-data datagram holding the number of datagrams sent, so
+ * that the sink knows when to stop and counts losses at the end too.
+ *
+ * Hardware timestamps are in the NIC's clock, which is only comparable
+ * with the source's clock if it is kept in step with the system clock
+ * (e.g. by phc2sys).
+ */
+
+#include "sock.h"
+#include <poll.h>
+#include <pthread.h>
+#ifdef	HAVE_LINUX_NET_TSTAMP_H
+#include <linux/net_tstamp.h>
+#endif
+
+#define	OWD_PROBES	8		/* clock offset probes */
+#define	OWD_MARK_PROBE	(~(uint64_t) 0)		/* in place of seq# */
+#define	OWD_MARK_OFFSET	(~(uint64_t) 0 - 1)
+#define	OWD_MARK_END	(~(uint64_t) 0 - 2)
+#define	OWD_END		3		/* #end-of-data datagrams */
+
+static struct hist	owd_hist;
+static pthread_mutex_t	hist_lock = PTHREAD_MUTEX_INITIALIZER;	/* owd_live() */
+static int64_t		offset;		/* sink clock - source clock, ns */
+static int		have_offset;
+static const char      *rx_source = "application";	/* of rx times */
+static uint64_t		rx_n, lost, reordered, negative;
+static uint64_t		next_seq;	/* highest seq# seen + 1 */
+static int64_t		prev_transit;
+static double		jitter;		/* ns */
+
+/*
+ * Source:  estimate the clock offset and tell the sink.
+ */
+void
+owd_sync(int sockfd)
+{
+	char		buf[32];
+	struct pollfd	pfd;
+	uint64_t	t1, t2, t3, t4, rtt, bestrtt;
+	int64_t		off;
+	int		i, n, nreplies;
+
+	bestrtt = 0;
+	nreplies = 0;
+	for (i = 0; i < OWD_PROBES; i++) {
+		bzero(buf, sizeof(buf));
+		put64(buf, OWD_MARK_PROBE);
+		put64(buf + 8, t1 = realtime_ns());
+		if (write(sockfd, buf, 16) != 16)
+			err_sys("write error for --owd probe");
+
+		pfd.fd = sockfd;
+		pfd.events = POLLIN;
+		if ( (n = poll(&pfd, 1, 1000)) < 0)
+			err_sys("poll error");
+		if (n == 0)
+			continue;		/* lost; try again */
+		if ( (n = read(sockfd, buf, sizeof(buf))) < 0)
+			err_sys("read error for --owd probe reply");
+		t4 = realtime_ns();
+		if (n < 32 || get64(buf) != OWD_MARK_PROBE ||
+		    get64(buf + 8) != t1)
+			continue;		/* stale or not ours */
+
+		t2 = get64(buf + 16);
+		t3 = get64(buf + 24);
+		rtt = (t4 - t1) - (t3 - t2);
+		off = ((int64_t) (t2 - t1) + (int64_t) (t3 - t4)) / 2;
+		if (nreplies++ == 0 || rtt < bestrtt) {
+			bestrtt = rtt;
+			offset = off;
+		}
+	}
+	if (nreplies == 0) {
+		fprintf(stderr, "warning: no replies to --owd probes; "
+		    "assuming synchronized clocks\n");
+		return;
+	}
+
+	bzero(buf, sizeof(buf));
+	put64(buf, OWD_MARK_OFFSET);
+	put64(buf + 8, offset);
+	put64(buf + 16, bestrtt);
+	for (i = 0; i < 2; i++)		/* once more, in case one is lost */
+		if (write(sockfd, buf, 24) != 24)
+			err_sys("write error for --owd offset");
+	fprintf(stderr, "clock offset: sink %+.1f us from source, "
+	    "+/- %.1f us (%d of %d probes answered)\n",
+	    offset / 1e3, bestrtt / 2e3, nreplies, OWD_PROBES);
+}
+
+/*
+ * Source:  tell the sink there is no more data, and how much was sent.
+ * Spaced out, so they aren't all dropped by a full receive buffer.
+ * The sink exits after the first, so later ones may be refused.
+ */
+void
+owd_finish(int sockfd)
+{
+	char	buf[16];
+	int	i;
+
+	put64(buf, OWD_MARK_END);
+	put64(buf + 8, stats.tx_msgs);
+	for (i = 0; i < OWD_END; i++) {
+		sleep_us(10000);
+		if (write(sockfd, buf, 16) < 0 && errno != ECONNREFUSED)
+			err_sys("write error for --owd end of data");
+	}
+}
+
+/*
+ * Sink:  ask for kernel receive timestamps.
+ */
+void
+owd_init(int sockfd)
+{
+	int	option;
+
+	hist_init(&owd_hist);
+#if	defined(SO_TIMESTAMPING) && defined(HAVE_LINUX_NET_TSTAMP_H)
+	option = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+	    SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING,
+		       &option, sizeof(option)) < 0)
+		err_sys("SO_TIMESTAMPING setsockopt error");
+#elif	defined(SO_TIMESTAMP)
+	option = 1;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMP,
+		       &option, sizeof(option)) < 0)
+		err_sys("SO_TIMESTAMP setsockopt error");
+#else
+	fprintf(stderr, "warning: SO_TIMESTAMPING not supported by host; "
+	    "using application receive times\n");
+#endif
+}
+
+/*
+ * Kernel receive time from the control messages, or 0.
+ */
+static uint64_t
+owd_rxtime(struct msghdr *msg)
+{
+	struct cmsghdr	*cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+#if	defined(SO_TIMESTAMPING) && defined(HAVE_LINUX_NET_TSTAMP_H)
+		if (cmsg->cmsg_type == SO_TIMESTAMPING) {
+			struct timespec	ts[3];	/* software, -, hardware */
+
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+			if (ts[2].tv_sec != 0 || ts[2].tv_nsec != 0) {
+				rx_source = "hardware";
+				return((uint64_t) ts[2].tv_sec * 1000000000 +
+				    ts[2].tv_nsec);
+			}
+			rx_source = "software";
+			return((uint64_t) ts[0].tv_sec * 1000000000 +
+			    ts[0].tv_nsec);
+		}
+#elif	defined(SO_TIMESTAMP)
+		if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+			struct timeval	tv;
+
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			rx_source = "software";
+			return((uint64_t) tv.tv_sec * 1000000000 +
+			    tv.tv_usec * 1000);
+		}
+#endif
+	}
+	return(0);
+}
+
+/*
+ * Sink:  account for one data datagram received at "rx".
+ */
+static void
+owd_delay(const char *buf, uint64_t rx)
+{
+	uint64_t	seq, tx;
+	int64_t		delay, transit, d;
+
+	tx = tstamp_get(buf, &seq);
+
+	delay = rx - tx - offset;
+	if (delay < 0) {
+		negative++;		/* offset estimate is off */
+		delay = 0;
+	}
+	pthread_mutex_lock(&hist_lock);
+	hist_add(&owd_hist, delay);
+	pthread_mutex_unlock(&hist_lock);
+
+	transit = rx - tx;		/* RFC 3550, section 6.4.1 */
+	if (rx_n > 0) {
+		d = transit - prev_transit;
+		jitter += ((d < 0 ? -d : d) - jitter) / 16;
+	}
+	prev_transit = transit;
+
+	if (seq < next_seq)
+		reordered++;
+	else
+		next_seq = seq + 1;
+	rx_n++;
+}
+
+/*
+ * Sink:  receive the next data datagram into "buf", answering clock
+ * offset probes along the way.  Returns as for recv().
+ */
+int
+owd_recv(int sockfd, char *buf, int len)
+{
+	struct msghdr		msg;
+	struct iovec		iov;
+	struct sockaddr_storage	from;
+	char			control[256], reply[32];
+	uint64_t		rx;
+	int			n;
+
+	for ( ; ; ) {
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		bzero(&msg, sizeof(msg));
+		msg.msg_name = &from;
+		msg.msg_namelen = sizeof(from);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		n = recvmsg(sockfd, &msg, 0);
+		stats_rxcall(len, n);
+		if (n <= 0)
+			return(n);
+		if ( (rx = owd_rxtime(&msg)) == 0)
+			rx = realtime_ns();
+
+		if (n >= 16 && get64(buf) == OWD_MARK_PROBE) {
+			memcpy(reply, buf, 16);
+			put64(reply + 16, rx);
+			put64(reply + 24, realtime_ns());
+			if (sendto(sockfd, reply, 32, 0,
+			    (struct sockaddr *) &from, msg.msg_namelen) < 0)
+				err_ret("sendto error for --owd probe reply");
+			continue;
+		}
+		if (n >= 24 && get64(buf) == OWD_MARK_OFFSET) {
+			offset = (int64_t) get64(buf + 8);
+			have_offset = 1;
+			continue;
+		}
+		if (n >= 16 && get64(buf) == OWD_MARK_END) {
+			next_seq = max(next_seq, get64(buf + 8));
+			return(0);		/* as if peer closed */
+		}
+		if (n >= TSTAMP_LEN)
+			owd_delay(buf, rx);
+		return(n);
+	}
+}
+
+/*
+ * The histogram so far, for SIGUSR1, from livestats' thread:  copied
+ * under the lock the sink adds to it under, so it isn't torn.
+ */
+void
+owd_live(void)
+{
+	struct hist	h;
+
+	hist_init(&h);
+	pthread_mutex_lock(&hist_lock);
+	hist_merge(&h, &owd_hist);
+	pthread_mutex_unlock(&hist_lock);
+	hist_report(&h, "one-way delay");
+	free(h.counts);
+}
+
+void
+owd_report(void)
+{
+	lost = (next_seq > rx_n) ? next_seq - rx_n : 0;
+	fprintf(stderr, "one-way delay:  %s receive timestamps, ", rx_source);
+	if (have_offset)
+		fprintf(stderr, "clock offset %+.1f us\n", offset / 1e3);
+	else
+		fprintf(stderr, "no clock offset (clocks assumed in step)\n");
+	hist_report(&owd_hist, "one-way delay");
+	fprintf(stderr, "jitter %.1f us, %llu lost, %llu reordered",
+	    jitter / 1e3, (unsigned long long) lost,
+	    (unsigned long long) reordered);
+	if (negative)
+		fprintf(stderr, ", %llu negative (counted as 0)",
+		    (unsigned long long) negative);
+	fprintf(stderr, "\n");
+	if (verbose)
+		hist_hgrm(&owd_hist, stderr);
+}
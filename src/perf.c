@@ -0,0 +1,188 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Hardware and software event counts for the source or sink loops,
+ * with --perf:  cycles, instructions, cache misses, branch misses and
+ * context switches, from perf_event_open(2), so that e.g. batching or
+ * zero copy can be judged by IPC and cache misses without running
+ * perf(1) alongside.
+ *
+ * Each loop thread opens its own counters (pid 0, any cpu, so only that
+ * thread is counted), enables them in stats_start() and reads them in
+ * stats_end(), into "stats", so with --conns they add up like the byte
+ * counts.  The kernel's share is counted too where perf_event_paranoid
+ * allows it, which perf_init() finds out once, before any loop starts;
+ * otherwise all the counters are for user space only, and the report
+ * says so.  If the counters had to be multiplexed
+ * (more events than the PMU has), the counts are scaled up by the time
+ * each was enabled over the time it ran.  An event the host or VM
+ * doesn't have is left out of the report.
+ */
+
+#include "sock.h"
+#ifdef	HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+static const struct {
+	uint32_t	 type;
+	uint64_t	 config;
+	const char	*name;
+} events[PERF_NEVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,	"cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,
+	  "context-switches" },
+};
+
+static __thread int	 perffd[PERF_NEVENTS];	/* this thread's, or -1 */
+static int		 useronly;	/* kernel not counted; set once */
+static int		 perferr[PERF_NEVENTS];	/* errno of first failure */
+
+static int
+perf_open(int i, int exclude_kernel)
+{
+	struct perf_event_attr	attr;
+
+	bzero(&attr, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+/*
+ * Before any loop thread starts:  see whether the kernel may be counted
+ * (perf_event_paranoid), so that every thread counts the same way.
+ */
+void
+perf_init(void)
+{
+	int	i, fd;
+
+	for (i = 0; i < PERF_NEVENTS; i++) {
+		if ( (fd = perf_open(i, 0)) >= 0) {
+			close(fd);
+			return;
+		}
+		if (errno == EACCES || errno == EPERM) {
+			useronly = 1;
+			return;
+		}
+	}
+}
+
+/* Called from stats_start(), with --perf. */
+void
+perf_thread_start(void)
+{
+	int	i;
+
+	for (i = 0; i < PERF_NEVENTS; i++) {
+		if ( (perffd[i] = perf_open(i, useronly)) < 0) {
+			if (perferr[i] == 0)
+				perferr[i] = errno;
+			continue;
+		}
+		if (ioctl(perffd[i], PERF_EVENT_IOC_RESET, 0) < 0 ||
+		    ioctl(perffd[i], PERF_EVENT_IOC_ENABLE, 0) < 0)
+			err_sys("perf_event ioctl error");
+	}
+}
+
+/* And from stats_end(). */
+void
+perf_thread_end(void)
+{
+	uint64_t	v[3];		/* value, time enabled, time running */
+	int		i;
+
+	for (i = 0; i < PERF_NEVENTS; i++) {
+		if (perffd[i] < 0)
+			continue;
+		ioctl(perffd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perffd[i], v, sizeof(v)) != sizeof(v))
+			err_sys("perf_event read error");
+		if (v[2] != 0 && v[2] < v[1])
+			v[0] = (double) v[0] * v[1] / v[2]; /* multiplexed */
+		stats.perf[i] = v[0];
+		stats.perfmask |= 1 << i;
+		close(perffd[i]);
+		perffd[i] = -1;
+	}
+}
+
+static void
+perf_line(const char *name, double v, uint64_t nbytes, uint64_t nmsgs)
+{
+	fprintf(stderr, "  %-16s %14.0f %12.4g %12.4g\n", name, v,
+	    nbytes ? v / nbytes : 0.0, nmsgs ? v / nmsgs : 0.0);
+}
+
+/*
+ * Print the counts in "s", in total, per byte and per write or read.
+ */
+void
+perf_report(const struct sockstats *s)
+{
+	uint64_t	nbytes, nmsgs;
+	int		i, n, err;
+
+	n = err = 0;
+	for (i = 0; i < PERF_NEVENTS; i++)
+		if (!(s->perfmask & (1 << i)) && perferr[i] != 0) {
+			fprintf(stderr, "%s%s",
+			    n++ ? ", " : "perf: can't count ", events[i].name);
+			err = perferr[i];
+		}
+	if (n > 0)
+		fprintf(stderr, " (%s)\n", strerror(err));
+	if (s->perfmask == 0)
+		return;
+
+	nbytes = s->tx_bytes + s->rx_bytes;
+	nmsgs = s->tx_msgs + s->rx_msgs;
+	fprintf(stderr, "perf (%s):\n",
+	    useronly ? "user only" : "user+kernel");
+	fprintf(stderr, "  %-16s %14s %12s %12s\n", "", "total", "per byte",
+	    l4_prot == L4_PROT_UDP ? "per datagram" :
+	    client ? "per write" : "per read");
+	for (i = 0; i < PERF_NEVENTS; i++)
+		if (s->perfmask & (1 << i))
+			perf_line(events[i].name, s->perf[i], nbytes, nmsgs);
+	if ((s->perfmask & 3) == 3 && s->perf[0] != 0)
+		fprintf(stderr, "  IPC %.2f\n",
+		    (double) s->perf[1] / s->perf[0]);
+}
+
+#else	/* HAVE_LINUX_PERF_EVENT_H */
+
+void
+perf_init(void)
+{
+	err_quit("--perf not supported by host");
+}
+
+void
+perf_thread_start(void)
+{
+}
+
+void
+perf_thread_end(void)
+{
+}
+
+void
+perf_report(const struct sockstats *s)
+{
+}
+
+#endif	/* HAVE_LINUX_PERF_EVENT_H */
@@ -0,0 +1,28 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * USDT static tracepoints, provider "sock", for perf, bpftrace or
+ * SystemTap.  With <sys/sdt.h> each one is a single nop in the code
+ * (the arguments are only named in an ELF note) until a tracer attaches;
+ * without it they compile to nothing.  sock.bt in the top directory
+ * lists them and uses them.
+ *
+ * A double underscore in the name shows as a dash to some tracers
+ * (write__start is "write-start" to SystemTap).
+ */
+
+#ifndef	__sock_probes_h
+#define	__sock_probes_h
+
+#ifdef	HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define	PROBE1(name, a)		DTRACE_PROBE1(sock, name, a)
+#define	PROBE2(name, a, b)	DTRACE_PROBE2(sock, name, a, b)
+#define	PROBE3(name, a, b, c)	DTRACE_PROBE3(sock, name, a, b, c)
+#else
+#define	PROBE1(name, a)		do { } while (0)
+#define	PROBE2(name, a, b)	do { } while (0)
+#define	PROBE3(name, a, b, c)	do { } while (0)
+#endif
+
+#endif	/* __sock_probes_h */
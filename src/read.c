@@ -0,0 +1,31 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Socket reads for the "sink" loops.  The counterpart of dowrite_hdr():
+ * with -V (or any of --iov, --iov-sizes, --iov-hdr) the data is scattered
+ * over the same iovec{} layout the source uses for writev(), with
+ * recvmsg() so that MSG_PEEK still works.
+ */
+
+#include "sock.h"
+
+ssize_t
+doread_hdr(int fd, void *hdr, size_t hdrlen, void *vptr, size_t nbytes,
+    int flags)
+{
+	struct msghdr	msg;
+	ssize_t		n;
+
+	if (usewritev == 0) {
+		n = recv(fd, vptr, nbytes, flags);		/* common case */
+		stats_rxcall(nbytes, n);
+		return(n);
+	}
+
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = iov_get();
+	msg.msg_iovlen = iov_fill(msg.msg_iov, hdr, hdrlen, vptr, nbytes);
+
+	n = recvmsg(fd, &msg, flags);
+	stats_rxcall(hdrlen + nbytes, n);
+	return(n);
+}
@@ -0,0 +1,387 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Machine-readable results, with --results file.  Everything the run
+ * reports is also kept here as name/value pairs, in sections:  the
+ * configuration, the socket options as the kernel has them after
+ * sockopts() (which may differ from what was asked for, e.g. SO_SNDBUF
+ * is doubled on Linux), the --sample time series, the per-connection
+ * counters with --conns, and the totals.  Nothing is written until the
+ * process exits, so the data path never waits on the file.
+ *
+ * --results-format json (the default) writes one JSON object per run:
+ *
+ *	{ "config": {...}, "sockopts": {...}, "intervals": [{...}, ...],
+ *	  "streams": [{...}, ...], "totals": {...} }
+ *
+ * and --results-format csv writes the same pairs as rows of
+ * "section,index,name,value", with a header row.  With -F each child
+ * writes "file.pid".  A number that isn't finite (e.g. a rate over no
+ * time at all) is written as null, or left empty in CSV.
+ *
+ * The file is also written if the run is stopped by SIGINT or SIGTERM,
+ * from livestats' thread, so records are added under a lock.
+ */
+
+#include "sock.h"
+#include <math.h>
+#include <pthread.h>
+#include <netinet/tcp.h>
+
+struct rec {
+	int	 section;	/* RES_xxx */
+	int	 index;		/* interval or stream number */
+	int	 isstr;		/* value is a string, quote it */
+	char	*name;
+	char	*value;
+};
+
+static const char *sections[] = {
+	"config", "sockopts", "intervals", "streams", "totals"
+};
+
+static struct rec	*recs;
+static size_t		 nrecs, maxrecs;
+static int		 havesockopts;	/* only the first socket's */
+static int		 written;	/* by results_write(), once */
+static pthread_mutex_t	 recs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+results_add(int section, int index, const char *name, const char *value,
+    int isstr)
+{
+	struct rec	*r;
+
+	pthread_mutex_lock(&recs_lock);
+	if (resultsfile == NULL) {
+		pthread_mutex_unlock(&recs_lock);
+		return;
+	}
+	if (nrecs == maxrecs) {
+		maxrecs = maxrecs ? 2 * maxrecs : 256;
+		if ( (recs = realloc(recs,
+		    maxrecs * sizeof(struct rec))) == NULL)
+			err_sys("realloc error for --results");
+	}
+	r = &recs[nrecs++];
+	r->section = section;
+	r->index = index;
+	r->isstr = isstr;
+	if ( (r->name = strdup(name)) == NULL ||
+	    (r->value = strdup(value)) == NULL)
+		err_sys("strdup error");
+	pthread_mutex_unlock(&recs_lock);
+}
+
+void
+results_str(int section, int index, const char *name, const char *value)
+{
+	results_add(section, index, name, value != NULL ? value : "", 1);
+}
+
+void
+results_u64(int section, int index, const char *name, uint64_t value)
+{
+	char	buf[24];
+
+	snprintf(buf, sizeof(buf), "%llu", (unsigned long long) value);
+	results_add(section, index, name, buf, 0);
+}
+
+void
+results_dbl(int section, int index, const char *name, double value)
+{
+	char	buf[32];
+
+	if (!isfinite(value))
+		buf[0] = 0;		/* null */
+	else
+		snprintf(buf, sizeof(buf), "%.15g", value);
+	results_add(section, index, name, buf, 0);
+}
+
+/*
+ * Record the configuration, once the options have been parsed.
+ */
+void
+results_init(char *host, char *port)
+{
+	const char	*io;
+
+	if (resultsfile == NULL)
+		return;
+	if (atexit(results_write) != 0)
+		err_quit("atexit error");
+
+	if (!sourcesink)
+		io = "stdio";
+	else
+		io = client ? "source" : "sink";
+	results_str(RES_CONFIG, 0, "version", VERSION);
+	results_dbl(RES_CONFIG, 0, "start_time", realtime_ns() / 1e9);
+	results_str(RES_CONFIG, 0, "role", client ? "client" : "server");
+	results_str(RES_CONFIG, 0, "io", io);
+	results_str(RES_CONFIG, 0, "protocol",
+	    l4_prot == L4_PROT_UDP ? "udp" :
+	    l4_prot == L4_PROT_SCTP ? "sctp" : "tcp");
+	results_str(RES_CONFIG, 0, "family",
+	    af_46 == AF_INET6 ? "inet6" : "inet");
+	if (destlist != NULL)
+		results_str(RES_CONFIG, 0, "dests", destlist);
+	else {
+		results_str(RES_CONFIG, 0, "host", host);
+		results_str(RES_CONFIG, 0, "port", port);
+	}
+	results_u64(RES_CONFIG, 0, "writelen", writelen);
+	results_u64(RES_CONFIG, 0, "readlen", readlen);
+	results_u64(RES_CONFIG, 0, "nbuf", nbuf);
+	results_u64(RES_CONFIG, 0, "sndbuf", sndbuflen);
+	results_u64(RES_CONFIG, 0, "rcvbuf", rcvbuflen);
+	results_u64(RES_CONFIG, 0, "nodelay", nodelay);
+	results_u64(RES_CONFIG, 0, "pause_ms", pauserw);
+	results_u64(RES_CONFIG, 0, "writev", usewritev);
+	results_u64(RES_CONFIG, 0, "chunkwrite", chunkwrite);
+	if (congestion != NULL)
+		results_str(RES_CONFIG, 0, "congestion", congestion);
+	if (nconns)
+		results_u64(RES_CONFIG, 0, "conns", nconns);
+	if (cpsconns)
+		results_u64(RES_CONFIG, 0, "cps", cpsconns);
+	if (sampleint)
+		results_u64(RES_CONFIG, 0, "sample_ms", sampleint);
+	if (fastopen)
+		results_u64(RES_CONFIG, 0, "fastopen", fastopen);
+	if (corkwrites)
+		results_u64(RES_CONFIG, 0, "cork", corkwrites);
+	if (msgmore)
+		results_u64(RES_CONFIG, 0, "msg_more", msgmore);
+	if (notsentlowat)
+		results_u64(RES_CONFIG, 0, "notsent_lowat", notsentlowat);
+}
+
+static void
+results_intopt(int fd, int level, int opt, const char *name)
+{
+	socklen_t	optlen;
+	int		val;
+
+	optlen = sizeof(val);
+	if (getsockopt(fd, level, opt, &val, &optlen) == 0)
+		results_u64(RES_SOCKOPT, 0, name, val);
+}
+
+/*
+ * Record the options in effect on "fd", once it is connected.  Only
+ * the first socket's are kept; with --conns they are all set alike.
+ */
+void
+results_sockopts(int fd)
+{
+	struct linger	l;
+	socklen_t	optlen;
+
+	if (resultsfile == NULL || havesockopts)
+		return;
+	havesockopts = 1;
+
+	results_intopt(fd, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF");
+	results_intopt(fd, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF");
+	results_intopt(fd, SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE");
+	results_intopt(fd, SOL_SOCKET, SO_REUSEADDR, "SO_REUSEADDR");
+	optlen = sizeof(l);
+	if (getsockopt(fd, SOL_SOCKET, SO_LINGER, &l, &optlen) == 0)
+		results_u64(RES_SOCKOPT, 0, "SO_LINGER",
+		    l.l_onoff ? l.l_linger : 0);
+#ifdef	IP_TOS
+	if (af_46 == AF_INET)
+		results_intopt(fd, IPPROTO_IP, IP_TOS, "IP_TOS");
+	else
+		results_intopt(fd, IPPROTO_IPV6, IPV6_TCLASS, "IPV6_TCLASS");
+#endif
+#ifdef	IP_TTL
+	if (af_46 == AF_INET)
+		results_intopt(fd, IPPROTO_IP, IP_TTL, "IP_TTL");
+	else
+		results_intopt(fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS,
+		    "IPV6_UNICAST_HOPS");
+#endif
+	if (l4_prot != L4_PROT_TCP)
+		return;
+	results_intopt(fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY");
+	results_intopt(fd, IPPROTO_TCP, TCP_MAXSEG, "TCP_MAXSEG");
+#ifdef	TCP_CONGESTION
+	{
+	char	name[64];
+
+	optlen = sizeof(name);
+	if (getsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, &optlen) == 0) {
+		name[min(optlen, sizeof(name) - 1)] = 0;
+		results_str(RES_SOCKOPT, 0, "TCP_CONGESTION", name);
+	}
+	}
+#endif
+}
+
+/*
+ * Record the totals for the run, from this thread's "stats", or if
+ * called from elsewhere (livestats' thread, on a signal) the loops'
+ * counters so far.
+ */
+static void
+results_totals(void)
+{
+	struct sockstats	s;
+	uint64_t		end;
+	double			secs;
+
+	if (stats.start_ns != 0)
+		s = stats;
+	else
+		stats_snapshot(&s);
+	if (s.start_ns == 0)
+		return;		/* not a source or sink run */
+	end = s.end_ns ? s.end_ns : time_ns();
+	secs = (end - s.start_ns) / 1e9;
+	results_dbl(RES_TOTAL, 0, "secs", secs);
+	results_u64(RES_TOTAL, 0, "tx_bytes", s.tx_bytes);
+	results_u64(RES_TOTAL, 0, "tx_msgs", s.tx_msgs);
+	results_u64(RES_TOTAL, 0, "tx_errors", s.tx_errors);
+	results_u64(RES_TOTAL, 0, "rx_bytes", s.rx_bytes);
+	results_u64(RES_TOTAL, 0, "rx_msgs", s.rx_msgs);
+	results_u64(RES_TOTAL, 0, "tx_calls", s.tx_calls);
+	results_u64(RES_TOTAL, 0, "tx_short", s.tx_short);
+	results_u64(RES_TOTAL, 0, "tx_eagain", s.tx_eagain);
+	results_u64(RES_TOTAL, 0, "tx_eintr", s.tx_eintr);
+	results_u64(RES_TOTAL, 0, "rx_calls", s.rx_calls);
+	results_u64(RES_TOTAL, 0, "rx_short", s.rx_short);
+	results_u64(RES_TOTAL, 0, "rx_eagain", s.rx_eagain);
+	results_u64(RES_TOTAL, 0, "rx_eintr", s.rx_eintr);
+	results_u64(RES_TOTAL, 0, "waits", s.waits);
+	if (secs > 0) {
+		results_dbl(RES_TOTAL, 0, "tx_mbps",
+		    s.tx_bytes * 8 / secs / 1e6);
+		results_dbl(RES_TOTAL, 0, "rx_mbps",
+		    s.rx_bytes * 8 / secs / 1e6);
+	}
+}
+
+static void
+json_string(FILE *fp, const char *s)
+{
+	putc('"', fp);
+	for ( ; *s != 0; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			putc(*s, fp);
+	}
+	putc('"', fp);
+}
+
+static void
+csv_string(FILE *fp, const char *s)
+{
+	if (strpbrk(s, ",\"\n") == NULL) {
+		fputs(s, fp);
+		return;
+	}
+	putc('"', fp);
+	for ( ; *s != 0; s++) {
+		if (*s == '"')
+			putc('"', fp);
+		putc(*s, fp);
+	}
+	putc('"', fp);
+}
+
+/*
+ * Write one section as a JSON object, or for intervals and streams an
+ * array of objects, one per index.  A section's records are added
+ * together, in index order.
+ */
+static void
+results_json_section(FILE *fp, int section, int *first)
+{
+	size_t	i;
+	int	index, isarray, n;
+
+	isarray = (section == RES_INTERVAL || section == RES_STREAM);
+	fprintf(fp, "%s\n  \"%s\": %s", *first ? "" : ",", sections[section],
+	    isarray ? "[" : "{");
+	*first = 0;
+	index = -1;
+	n = 0;
+	for (i = 0; i < nrecs; i++) {
+		if (recs[i].section != section)
+			continue;
+		if (isarray && recs[i].index != index) {
+			fprintf(fp, "%s\n    {", index < 0 ? "" : " },");
+			index = recs[i].index;
+			n = 0;
+		}
+		fprintf(fp, "%s%s", n++ ? "," : "", isarray ? " " : "\n    ");
+		json_string(fp, recs[i].name);
+		fputs(": ", fp);
+		if (recs[i].isstr)
+			json_string(fp, recs[i].value);
+		else
+			fputs(recs[i].value[0] ? recs[i].value : "null", fp);
+	}
+	if (isarray)
+		fprintf(fp, "%s\n  ]", index < 0 ? "" : " }");
+	else
+		fputs("\n  }", fp);
+}
+
+/*
+ * Called at exit, or on SIGINT or SIGTERM:  add the totals and write the
+ * file, once.
+ */
+void
+results_write(void)
+{
+	static char	 iobuf[65536];
+	FILE		*fp;
+	char		*name;
+	size_t		 i;
+	int		 s, first;
+
+	if (resultsfile == NULL || __atomic_exchange_n(&written, 1,
+	    __ATOMIC_ACQ_REL))
+		return;
+	results_totals();
+	pthread_mutex_lock(&recs_lock);	/* no more records from here */
+
+	name = resultsfile;
+	if (dofork && server) {
+		if ( (name = malloc(strlen(resultsfile) + 24)) == NULL)
+			err_sys("malloc error");
+		sprintf(name, "%s.%ld", resultsfile, (long) getpid());
+	}
+	resultsfile = NULL;		/* none added now, nor by err_sys() */
+	if ( (fp = fopen(name, "w")) == NULL)
+		err_sys("can't open %s", name);
+	setvbuf(fp, iobuf, _IOFBF, sizeof(iobuf));
+
+	if (resultscsv) {
+		fputs("section,index,name,value\n", fp);
+		for (i = 0; i < nrecs; i++) {
+			fprintf(fp, "%s,%d,", sections[recs[i].section],
+			    recs[i].index);
+			csv_string(fp, recs[i].name);
+			putc(',', fp);
+			csv_string(fp, recs[i].value);
+			putc('\n', fp);
+		}
+	} else {
+		fputs("{", fp);
+		first = 1;
+		for (s = RES_CONFIG; s <= RES_TOTAL; s++)
+			results_json_section(fp, s, &first);
+		fputs("\n}\n", fp);
+	}
+	pthread_mutex_unlock(&recs_lock);
+	if (fclose(fp) != 0)
+		err_sys("write error on %s", name);
+}
@@ -0,0 +1,268 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * TCP_INFO time series, with --sample ms.  A separate thread reads
+ * TCP_INFO (SCTP_STATUS with -5) on the source or sink connection every
+ * "ms" milliseconds, and keeps the samples in memory, so the data path
+ * does no extra system calls or I/O.  When the connection is about to
+ * be closed the thread is stopped and the series is written out:  as
+ * CSV (to stderr, or --sample-file), or with --sample-bin as binary
+ * records, which are much smaller for long runs at short intervals.
+ *
+ * The binary file is an 8-byte magic "SOCKSMPL", then the 64-bit
+ * big-endian values:  version, protocol (L4_PROT_*), #fields per record,
+ * #records; then the records, each "#fields" 64-bit big-endian values
+ * in the same order as the CSV columns.
+ */
+
+#include "sock.h"
+#include <pthread.h>
+#include <time.h>
+#ifdef	HAVE_NETINET_SCTP_H
+#include <netinet/sctp.h>
+#endif
+
+#define	SAMPLE_VERSION	1
+#define	NFIELDS		12		/* 64-bit values per sample */
+
+static const char *tcp_fields[NFIELDS] = {
+	"ms", "cwnd", "srtt_us", "rttvar_us", "retrans", "pacing_rate",
+	"delivery_rate", "rwnd_limited_us", "sndbuf_limited_us",
+	"bytes_acked", "unacked", "notsent_bytes"
+};
+static const char *sctp_fields[NFIELDS] = {
+	"ms", "cwnd", "srtt_ms", "rto_ms", "rwnd", "unackdata", "penddata",
+	"state", "instrms", "outstrms", "mtu", "fragmentation_point"
+};
+
+static int		 sfd;		/* connection being sampled */
+static uint64_t		 start;		/* time_ns() at first sample */
+static uint64_t		(*samples)[NFIELDS];
+static size_t		 nsamples, maxsamples;
+static const char	*errmsg;	/* why the thread stopped early */
+
+static pthread_t	 tid;
+static pthread_mutex_t	 lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 cond = PTHREAD_COND_INITIALIZER;
+static int		 stopping;
+static int		 running;
+
+/*
+ * Take one sample into "v".  Returns 0, or -1 if the host can't.
+ */
+static int
+sample_take(uint64_t *v)
+{
+	v[0] = (time_ns() - start) / 1000000;
+
+	if (l4_prot == L4_PROT_SCTP) {
+#if	defined(HAVE_NETINET_SCTP_H) && defined(SCTP_STATUS)
+		struct sctp_status	st;
+		socklen_t		optlen;
+
+		bzero(&st, sizeof(st));
+		optlen = sizeof(st);
+		if (getsockopt(sfd, IPPROTO_SCTP, SCTP_STATUS,
+		    &st, &optlen) < 0) {
+			errmsg = "SCTP_STATUS getsockopt error";
+			return(-1);
+		}
+		v[1] = st.sstat_primary.spinfo_cwnd;
+		v[2] = st.sstat_primary.spinfo_srtt;
+		v[3] = st.sstat_primary.spinfo_rto;
+		v[4] = st.sstat_rwnd;
+		v[5] = st.sstat_unackdata;
+		v[6] = st.sstat_penddata;
+		v[7] = st.sstat_state;
+		v[8] = st.sstat_instrms;
+		v[9] = st.sstat_outstrms;
+		v[10] = st.sstat_primary.spinfo_mtu;
+		v[11] = st.sstat_fragmentation_point;
+		return(0);
+#else
+		errmsg = "SCTP_STATUS not supported by host";
+		return(-1);
+#endif
+	} else {
+		struct tcpstat	ts;
+
+		if (tcpinfo_get(sfd, &ts) < 0) {
+			errmsg = (errno == ENOPROTOOPT) ?
+			    "TCP_INFO not supported by host" :
+			    "TCP_INFO getsockopt error";
+			return(-1);
+		}
+		v[1] = ts.snd_cwnd;
+		v[2] = ts.rtt_us;
+		v[3] = ts.rttvar_us;
+		v[4] = ts.retrans;
+		v[5] = ts.pacing_rate;
+		v[6] = ts.delivery_rate;
+		v[7] = ts.rwnd_limited_us;
+		v[8] = ts.sndbuf_limited_us;
+		v[9] = ts.bytes_acked;
+		v[10] = ts.unacked;
+		v[11] = ts.notsent_bytes;
+		return(0);
+	}
+}
+
+static void *
+sampler_thread(void *arg)
+{
+	struct timespec	deadline;
+	uint64_t	next, now;
+
+	(void) arg;
+	next = start;
+	pthread_mutex_lock(&lock);
+	while (!stopping) {
+		pthread_mutex_unlock(&lock);
+		if (nsamples == maxsamples) {
+			maxsamples = maxsamples ? 2 * maxsamples : 1024;
+			if ( (samples = realloc(samples,
+			    maxsamples * sizeof(*samples))) == NULL)
+				err_sys("realloc error for --sample");
+		}
+		if (sample_take(samples[nsamples]) < 0) {
+			pthread_mutex_lock(&lock);
+			break;
+		}
+		nsamples++;
+
+		/*
+		 * Sleep until the next interval, or until told to stop.
+		 * The condition variable uses CLOCK_REALTIME, so convert.
+		 */
+		next += (uint64_t) sampleint * 1000000;
+		now = time_ns();
+		if (next < now)
+			next = now;	/* fell behind; don't catch up */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += (next - now) / 1000000000;
+		deadline.tv_nsec += (next - now) % 1000000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&lock);
+		while (!stopping && pthread_cond_timedwait(&cond, &lock,
+		    &deadline) == 0)
+			;
+	}
+	pthread_mutex_unlock(&lock);
+	return(NULL);
+}
+
+/*
+ * Start sampling "sockfd", once it is connected.
+ */
+void
+sampler_start(int sockfd)
+{
+	int	rc;
+
+	sfd = sockfd;
+	start = time_ns();
+	if ( (rc = pthread_create(&tid, NULL, sampler_thread, NULL)) != 0) {
+		errno = rc;
+		err_sys("pthread_create error");
+	}
+	running = 1;
+}
+
+static void
+sampler_csv(FILE *fp)
+{
+	const char	**fields;
+	size_t		  i;
+	int		  j;
+
+	fields = (l4_prot == L4_PROT_SCTP) ? sctp_fields : tcp_fields;
+	for (j = 0; j < NFIELDS; j++)
+		fprintf(fp, "%s%s", fields[j], j < NFIELDS - 1 ? "," : "\n");
+	for (i = 0; i < nsamples; i++)
+		for (j = 0; j < NFIELDS; j++)
+			fprintf(fp, "%llu%s", (unsigned long long) samples[i][j],
+			    j < NFIELDS - 1 ? "," : "\n");
+}
+
+static void
+sampler_bin(FILE *fp)
+{
+	char	buf[8];
+	size_t	i;
+	int	j;
+
+	fwrite("SOCKSMPL", 1, 8, fp);
+	put64(buf, SAMPLE_VERSION);
+	fwrite(buf, 1, 8, fp);
+	put64(buf, l4_prot);
+	fwrite(buf, 1, 8, fp);
+	put64(buf, NFIELDS);
+	fwrite(buf, 1, 8, fp);
+	put64(buf, nsamples);
+	fwrite(buf, 1, 8, fp);
+	for (i = 0; i < nsamples; i++)
+		for (j = 0; j < NFIELDS; j++) {
+			put64(buf, samples[i][j]);
+			fwrite(buf, 1, 8, fp);
+		}
+}
+
+/*
+ * Hand the series to --results, one interval per sample.
+ */
+static void
+sampler_results(void)
+{
+	const char	**fields;
+	size_t		  i;
+	int		  j;
+
+	fields = (l4_prot == L4_PROT_SCTP) ? sctp_fields : tcp_fields;
+	for (i = 0; i < nsamples; i++)
+		for (j = 0; j < NFIELDS; j++)
+			results_u64(RES_INTERVAL, i, fields[j], samples[i][j]);
+}
+
+/*
+ * Stop the thread, before the connection is closed, and write out the
+ * series.
+ */
+void
+sampler_stop(void)
+{
+	FILE	*fp;
+
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(tid, NULL);
+	running = 0;
+
+	if (errmsg != NULL)
+		fprintf(stderr, "warning: sampling stopped: %s\n", errmsg);
+
+	if (resultsfile != NULL)
+		sampler_results();
+
+	if (samplefile == NULL)
+		fp = stderr;
+	else if ( (fp = fopen(samplefile, samplebin ? "wb" : "w")) == NULL)
+		err_sys("can't open %s", samplefile);
+
+	if (samplebin)
+		sampler_bin(fp);
+	else
+		sampler_csv(fp);
+
+	if (fp != stderr) {
+		if (fclose(fp) != 0)
+			err_sys("write error on %s", samplefile);
+		fprintf(stderr, "%llu samples written to %s\n",
+		    (unsigned long long) nsamples, samplefile);
+	}
+}
@@ -15,6 +15,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "sock.h"
+#include "probes.h"
+#include <signal.h>
 
 int
 servopen(char *host, char *port)
@@ -131,12 +133,14 @@ servopen(char *host, char *port)
 	join_mcast_server(fd, &servaddr4, &servaddr6);
 
 	/*
-	 * UDP:  Connect to foreign IPv4/IPv6 address and foreign port,
+	 * UDP:  Allocate the buffers (there is no accept() to do it later),
+	 * then connect to foreign IPv4/IPv6 address and foreign port,
 	 * if specified.
 	 */
-	if ((L4_PROT_UDP == l4_prot) && (0 != foreignip[0])) {
+	if (L4_PROT_UDP == l4_prot)
 		buffers(fd);
 
+	if ((L4_PROT_UDP == l4_prot) && (0 != foreignip[0])) {
 		if (AF_INET == af_46) {
 			bzero(&cliaddr4, sizeof(cliaddr4));
 			if (inet_pton(AF_INET, foreignip,
@@ -190,9 +194,15 @@ servopen(char *host, char *port)
 		sleep_us(pauselisten*1000);
 	}
 
+	if (nconns)
+		return(fd);	/* conn_serve() does the accept()s */
+
 	if (dofork) {
 		/* initialize synchronization primitives */
 		TELL_WAIT();
+		/* the parent only waits for SIGUSR2; SIGUSR1 is for the
+		   children's livestats_start() */
+		signal(SIGUSR1, SIG_IGN);
 	}
 
 	for ( ; ; ) {
@@ -217,6 +227,8 @@ servopen(char *host, char *port)
 			if (pid > 0) {
 				/* parent closes connected socket */
 				close(newfd);
+				/* next child, next --cpus CPU */
+				affinity_fork();
 				/* wait for child to output to terminal */
 				WAIT_CHILD();
 				/* and back to for(;;) for another accept() */
@@ -282,6 +294,7 @@ servopen(char *host, char *port)
 			TELL_PARENT(getppid());
 		}
 
+		PROBE2(conn__open, newfd, 1);
 		return(newfd);
 	}
 }
@@ -0,0 +1,414 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Live counters in shared memory, with --shm[=name], for a monitor to
+ * read without asking the process anything.  The segment (POSIX
+ * shm_open(), "/sock.<pid>" by default; with -F each child adds
+ * ".<pid>" to a given name) is a header and then one slot per stream
+ * (--conns connections, else one).  The source and sink loops update
+ * their slot after every read or write with plain stores, so the data
+ * path makes no extra system calls.  The segment is removed at exit,
+ * or on SIGINT or SIGTERM (see livestats.c).
+ *
+ * Layout, version SHM_VERSION, all values in host byte order:  the
+ * header is SHM_HDRSIZE bytes; the slots follow, each "slot_size" bytes
+ * and cache-line aligned, so that streams on different threads don't
+ * share a line.  Readers should use hdr_size and slot_size from the
+ * header, not sizeof(), since later versions only add fields at the end.
+ * "magic" is written last, once the rest of the header is there.
+ *
+ * Each slot is a seqlock:  the writer makes "seq" odd, updates the
+ * counters, and makes it even again; a reader copies the slot and
+ * retries if "seq" was odd or changed meanwhile.
+ *
+ * "sock --shm-read [name ...]" prints every segment given, or all the
+ * "sock.*" ones in /dev/shm, and the totals over those still running.
+ */
+
+#include "sock.h"
+
+__thread struct shm_slot *shmslot;	/* this thread's, while running */
+
+#ifdef	HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#define	SHM_MAGIC	"SOCKSHM"	/* 8 bytes with the NUL */
+#define	SHM_VERSION	1
+#define	SHM_HDRSIZE	192
+#define	SHM_LINE	64		/* cache line */
+
+struct shm_hdr {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	hdr_size;	/* offset of slot 0 */
+	uint32_t	slot_size;
+	uint32_t	nslots;
+	uint32_t	nused;		/* slots taken so far */
+	uint32_t	pid;
+	uint32_t	role;		/* 0 client, 1 server */
+	uint32_t	l4_prot;	/* L4_PROT_* */
+	uint64_t	start_ns;	/* CLOCK_REALTIME, ns */
+	char		desc[128];	/* peer, or --dests, or port */
+};
+
+struct shm_slot {
+	uint64_t	seq;		/* odd while being updated */
+	uint32_t	state;		/* SHM_IDLE etc */
+	uint32_t	index;		/* stream number */
+	uint64_t	start_ns;	/* CLOCK_REALTIME */
+	uint64_t	end_ns;		/* 0 while running */
+	uint64_t	tx_bytes;
+	uint64_t	tx_msgs;
+	uint64_t	tx_errors;
+	uint64_t	rx_bytes;
+	uint64_t	rx_msgs;
+} __attribute__((aligned(SHM_LINE)));
+
+enum { SHM_IDLE, SHM_RUNNING, SHM_DONE };
+
+static struct shm_hdr	*hdr;
+static struct shm_slot	*slots;
+static char		 segname[256];
+
+/*
+ * Make the slot's "seq" odd, for an update, and even again after.
+ */
+static void
+shm_begin(struct shm_slot *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+shm_end(struct shm_slot *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy this thread's "stats" into its slot.  No system calls:  called
+ * after every read and write.
+ */
+void
+shm_publish(void)
+{
+	struct shm_slot	*s = shmslot;
+
+	shm_begin(s);
+	__atomic_store_n(&s->tx_bytes, stats.tx_bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->tx_msgs, stats.tx_msgs, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->tx_errors, stats.tx_errors, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->rx_bytes, stats.rx_bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->rx_msgs, stats.rx_msgs, __ATOMIC_RELAXED);
+	shm_end(s);
+}
+
+/*
+ * A source or sink loop is starting on this thread:  give it a slot.
+ */
+void
+shm_stream_start(void)
+{
+	struct shm_slot	*s;
+	uint32_t	 i;
+
+	if (hdr == NULL)
+		return;
+	i = __atomic_fetch_add(&hdr->nused, 1, __ATOMIC_RELAXED);
+	s = &slots[i % hdr->nslots];	/* reused by --cc-compare runs */
+	shm_begin(s);
+	__atomic_store_n(&s->state, SHM_RUNNING, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->index, i, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->start_ns, realtime_ns(), __ATOMIC_RELAXED);
+	__atomic_store_n(&s->end_ns, 0, __ATOMIC_RELAXED);
+	shm_end(s);
+	shmslot = s;
+	shm_publish();
+}
+
+/*
+ * And it's done.
+ */
+void
+shm_stream_end(void)
+{
+	struct shm_slot	*s = shmslot;
+
+	if (s == NULL)
+		return;
+	shm_publish();
+	shm_begin(s);
+	__atomic_store_n(&s->end_ns, realtime_ns(), __ATOMIC_RELAXED);
+	__atomic_store_n(&s->state, SHM_DONE, __ATOMIC_RELAXED);
+	shm_end(s);
+	shmslot = NULL;
+}
+
+/*
+ * Remove the segment:  at exit, or from livestats' thread on SIGINT or
+ * SIGTERM, so that a run stopped by one doesn't leave it behind.
+ */
+void
+shm_remove(void)
+{
+	if (hdr != NULL)
+		shm_unlink(segname);
+}
+
+/*
+ * Create the segment, with room for "nstreams" streams.  Called once
+ * the connection (with -F, the child's) or the --conns run is about to
+ * start.
+ */
+void
+shm_init(int nstreams, char *host, char *port)
+{
+	size_t	size;
+	int	fd;
+
+	if (shmname == NULL)
+		return;
+	if (shmname[0] != 0)
+		snprintf(segname, sizeof(segname), "%s%s",
+		    shmname[0] == '/' ? "" : "/", shmname);
+	else
+		snprintf(segname, sizeof(segname), "/sock.%ld",
+		    (long) getpid());
+	if (dofork && server && shmname[0] != 0)
+		snprintf(segname + strlen(segname),
+		    sizeof(segname) - strlen(segname), ".%ld",
+		    (long) getpid());
+
+	size = SHM_HDRSIZE + nstreams * sizeof(struct shm_slot);
+	if ( (fd = shm_open(segname, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
+		err_sys("shm_open error for %s", segname);
+	if (ftruncate(fd, size) < 0)
+		err_sys("ftruncate error for %s", segname);
+	if ( (hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    fd, 0)) == MAP_FAILED)
+		err_sys("mmap error for %s", segname);
+	close(fd);
+	if (atexit(shm_remove) != 0)
+		err_quit("atexit error");
+	slots = (struct shm_slot *) ((char *) hdr + SHM_HDRSIZE);
+
+	hdr->version = SHM_VERSION;
+	hdr->hdr_size = SHM_HDRSIZE;
+	hdr->slot_size = sizeof(struct shm_slot);
+	hdr->nslots = nstreams;
+	hdr->pid = getpid();
+	hdr->role = server;
+	hdr->l4_prot = l4_prot;
+	hdr->start_ns = realtime_ns();
+	if (destlist != NULL)
+		snprintf(hdr->desc, sizeof(hdr->desc), "%s", destlist);
+	else if (client)
+		snprintf(hdr->desc, sizeof(hdr->desc), "%s %s", host, port);
+	else
+		snprintf(hdr->desc, sizeof(hdr->desc), "port %s", port);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(hdr->magic, SHM_MAGIC, sizeof(hdr->magic));
+	if (verbose)
+		fprintf(stderr, "counters in shared memory %s\n", segname);
+}
+
+/*
+ * Reader:  a consistent copy of slot "s".  If its writer died in the
+ * middle of an update, settle for what's there.
+ */
+static void
+shm_copy(const struct shm_slot *s, struct shm_slot *copy)
+{
+	uint64_t	seq;
+	int		tries;
+
+	bzero(copy, sizeof(*copy));	/* SHM_IDLE */
+#define	LOAD(x)	__atomic_load_n(&s->x, __ATOMIC_RELAXED)
+	for (tries = 0; tries < 1000000; tries++) {
+		if ( (seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+			continue;		/* being updated */
+		copy->state = LOAD(state);
+		copy->index = LOAD(index);
+		copy->start_ns = LOAD(start_ns);
+		copy->end_ns = LOAD(end_ns);
+		copy->tx_bytes = LOAD(tx_bytes);
+		copy->tx_msgs = LOAD(tx_msgs);
+		copy->tx_errors = LOAD(tx_errors);
+		copy->rx_bytes = LOAD(rx_bytes);
+		copy->rx_msgs = LOAD(rx_msgs);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (LOAD(seq) == seq)
+			return;
+	}
+#undef	LOAD
+}
+
+struct shm_total {
+	int		ninst, nstreams;
+	uint64_t	tx_bytes, rx_bytes, tx_errors;
+	double		tx_mbps, rx_mbps;
+};
+
+/*
+ * Print one segment, and add it to "t" if its process is still there.
+ */
+static void
+shm_show(const char *name, struct shm_total *t)
+{
+	struct shm_hdr	*h;
+	struct shm_slot	 s;
+	struct stat	 st;
+	uint64_t	 now, tx, rx, err;
+	double		 secs, txr, rxr;
+	uint32_t	 i, n, nrun;
+	int		 fd, alive;
+	char		 path[256];
+
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+	if ( (fd = shm_open(path, O_RDONLY, 0)) < 0) {
+		err_ret("shm_open error for %s", path);
+		return;
+	}
+	if (fstat(fd, &st) < 0)
+		err_sys("fstat error for %s", path);
+	if (st.st_size < SHM_HDRSIZE ||
+	    (h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+	    MAP_FAILED) {
+		fprintf(stderr, "%s: not a sock segment\n", path);
+		close(fd);
+		return;
+	}
+	close(fd);
+	if (memcmp(h->magic, SHM_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != SHM_VERSION ||
+	    h->hdr_size + (uint64_t) h->nslots * h->slot_size >
+	    (uint64_t) st.st_size) {
+		fprintf(stderr, "%s: not a version %d sock segment\n",
+		    path, SHM_VERSION);
+		munmap(h, st.st_size);
+		return;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);	/* after "magic" */
+	alive = (kill(h->pid, 0) == 0 || errno == EPERM);
+
+	now = realtime_ns();
+	n = min(__atomic_load_n(&h->nused, __ATOMIC_RELAXED), h->nslots);
+	tx = rx = err = 0;
+	txr = rxr = 0;
+	nrun = 0;
+	for (i = 0; i < n; i++) {
+		shm_copy((struct shm_slot *) ((char *) h + h->hdr_size +
+		    i * h->slot_size), &s);
+		if (s.state == SHM_IDLE)
+			continue;
+		secs = ((s.end_ns ? s.end_ns : now) - s.start_ns) / 1e9;
+		if (s.state == SHM_RUNNING && secs > 0) {
+			nrun++;
+			txr += s.tx_bytes * 8 / secs / 1e6;
+			rxr += s.rx_bytes * 8 / secs / 1e6;
+		}
+		tx += s.tx_bytes;
+		rx += s.rx_bytes;
+		err += s.tx_errors;
+		if (verbose)
+			printf("  stream %u: %s, %.3f sec, sent %llu bytes in "
+			    "%llu writes (%llu errors), received %llu bytes in "
+			    "%llu reads\n", s.index, s.state == SHM_RUNNING ?
+			    "running" : "done", secs,
+			    (unsigned long long) s.tx_bytes,
+			    (unsigned long long) s.tx_msgs,
+			    (unsigned long long) s.tx_errors,
+			    (unsigned long long) s.rx_bytes,
+			    (unsigned long long) s.rx_msgs);
+	}
+	printf("%s: pid %u%s, %s %s %s, up %.1f sec, %u of %u streams "
+	    "running, sent %llu bytes, received %llu bytes, %llu write "
+	    "errors, average %.3f Mbit/s out, %.3f Mbit/s in\n", path, h->pid,
+	    alive ? "" : " (exited)", h->l4_prot == L4_PROT_UDP ? "udp" :
+	    h->l4_prot == L4_PROT_SCTP ? "sctp" : "tcp",
+	    h->role ? "server" : "client", h->desc,
+	    (now - h->start_ns) / 1e9, nrun, h->nslots,
+	    (unsigned long long) tx, (unsigned long long) rx,
+	    (unsigned long long) err, txr, rxr);
+	if (alive) {
+		t->ninst++;
+		t->nstreams += nrun;
+		t->tx_bytes += tx;
+		t->rx_bytes += rx;
+		t->tx_errors += err;
+		t->tx_mbps += txr;
+		t->rx_mbps += rxr;
+	}
+	munmap(h, st.st_size);
+}
+
+/*
+ * sock --shm-read [name ...]
+ */
+void
+shm_read(int argc, char **argv)
+{
+	struct shm_total	 t;
+	struct dirent		*d;
+	DIR			*dir;
+	int			 i;
+
+	bzero(&t, sizeof(t));
+	if (argc > 0) {
+		for (i = 0; i < argc; i++)
+			shm_show(argv[i], &t);
+	} else {
+		/* where Linux keeps POSIX shared memory */
+		if ( (dir = opendir("/dev/shm")) == NULL)
+			err_sys("can't list /dev/shm; give the segment names");
+		while ( (d = readdir(dir)) != NULL)
+			if (strncmp(d->d_name, "sock.", 5) == 0)
+				shm_show(d->d_name, &t);
+		closedir(dir);
+	}
+	printf("total: %d running instances, %d streams, sent %llu bytes, "
+	    "received %llu bytes, %llu write errors, average %.3f Mbit/s "
+	    "out, %.3f Mbit/s in\n", t.ninst, t.nstreams,
+	    (unsigned long long) t.tx_bytes, (unsigned long long) t.rx_bytes,
+	    (unsigned long long) t.tx_errors, t.tx_mbps, t.rx_mbps);
+}
+
+#else	/* no shared memory */
+
+void
+shm_publish(void)
+{
+}
+
+void
+shm_stream_start(void)
+{
+}
+
+void
+shm_stream_end(void)
+{
+}
+
+void
+shm_remove(void)
+{
+}
+
+void
+shm_init(int nstreams, char *host, char *port)
+{
+	if (shmname != NULL)
+		err_quit("--shm not supported by host");
+}
+
+void
+shm_read(int argc, char **argv)
+{
+	err_quit("--shm-read not supported by host");
+}
+#endif	/* HAVE_SYS_MMAN_H */
@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include "sock.h"
+#include "probes.h"
 
 /*
  * Invoked for an SCTP server when sourcesink is set by the -i option.
@@ -19,23 +20,33 @@ void
 sink_sctp(int sockfd)
 {
 	int		n, flags;
+	char	       *buf;
 
 	if (pauseinit) {
 		sleep_us(pauseinit * 1000);
 	}
 
+	stats_start();
 	/*
 	 * Read until peer closes connection; -n option ignored.
 	 */
 	for ( ; ; ) {
 		/* msgpeek = 0 or MSG_PEEK */
 		flags = msgpeek;
+		/* rbuf, or borrowed from the pool */
+		buf = rbuf_get(sockfd);
 oncemore:
-		if ( (n = recv(sockfd, rbuf, readlen, flags)) < 0) {
+		PROBE3(read__start, sockfd, stats.rx_msgs + 1, readlen);
+		iotime_start();
+		n = doread_hdr(sockfd, hbuf, iovhdrlen, buf, readlen, flags);
+		iotime_done();
+		PROBE3(read__done, sockfd, stats.rx_msgs + 1, n);
+		if (n < 0) {
 			err_sys("recv error");
 		} else if (n == 0) {
+			rbuf_put(buf);
 			if (verbose)
-				fprintf(stderr, "connection closed by peer\n");
+				vlog("connection closed by peer\n");
 			break;
 			
 #ifdef notdef
@@ -47,10 +58,20 @@ oncemore:
 		}
 #endif
 	
+		if (flags == 0) {	/* don't count MSG_PEEK twice */
+			stats_rx(n);
+			if (timestamp) {
+				tstamp_stream(buf, n, writelen);
+			}
+		}
 		if (verbose) {
-			fprintf(stderr, "received %d bytes%s\n", n,
+			vlog("received %d bytes%s\n", n,
 				(flags == MSG_PEEK) ? " (MSG_PEEK)" : "");
 		}
+		if (flags == 0) {
+			/* not held while idle */
+			rbuf_put(buf);
+		}
 		if (pauserw) {
 			sleep_us(pauserw * 1000);
 		}
@@ -61,15 +82,20 @@ oncemore:
 			goto oncemore;
 		}
 	}
+	stats_end();
+
+	if (sampleint)
+		sampler_stop();		/* before close() */
 
 	if (pauseclose) {
 		if (verbose) {
-			fprintf(stderr, "pausing before close\n");
+			vlog("pausing before close\n");
 		}
 		sleep_us(pauseclose * 1000);
  	}
 
 	/* Relevant to SCTP? */
+	PROBE1(conn__close, sockfd);
 	if (close(sockfd) < 0) {
 		err_sys("close error");
 	}
@@ -10,25 +10,35 @@
 
 #include <stdio.h>
 #include	"sock.h"
+#include "probes.h"
 
 void
 sink_tcp(int sockfd)
 {
 	int		n, flags;
+	char	       *buf;
 
 	if (pauseinit)
 		sleep_us(pauseinit*1000);
 
+	stats_start();
 	for ( ; ; ) {	/* read until peer closes connection; -n opt ignored */
 			/* msgpeek = 0 or MSG_PEEK */
 		flags = msgpeek;
+		buf = rbuf_get(sockfd);	/* rbuf, or borrowed from the pool */
 	oncemore:
-		if ( (n = recv(sockfd, rbuf, readlen, flags)) < 0) {
+		PROBE3(read__start, sockfd, stats.rx_msgs + 1, readlen);
+		iotime_start();
+		n = doread_hdr(sockfd, hbuf, iovhdrlen, buf, readlen, flags);
+		iotime_done();
+		PROBE3(read__done, sockfd, stats.rx_msgs + 1, n);
+		if (n < 0) {
 			err_sys("recv error");
 			
 		} else if (n == 0) {
+			rbuf_put(buf);
 			if (verbose)
-				fprintf(stderr, "connection closed by peer\n");
+				vlog("connection closed by peer\n");
 			break;
 			
 #ifdef	notdef		/* following not possible with TCP */
@@ -37,10 +47,19 @@ sink_tcp(int sockfd)
 #else
 		}
 #endif
+
+		if (flags == 0) {	/* don't count MSG_PEEK twice */
+			stats_rx(n);
+			if (timestamp)
+				tstamp_stream(buf, n, writelen);
+		}
 	
 		if (verbose)
-			fprintf(stderr, "received %d bytes%s\n", n,
+			vlog("received %d bytes%s\n", n,
 				(flags == MSG_PEEK) ? " (MSG_PEEK)" : "");
+
+		if (flags == 0)
+			rbuf_put(buf);	/* not held while idle */
 		
 		if (pauserw)
 			sleep_us(pauserw*1000);
@@ -50,13 +69,18 @@ sink_tcp(int sockfd)
 			goto oncemore;	/* read the message again */
 		}
 	}
+	stats_end();
+
+	if (sampleint)
+		sampler_stop();		/* before close() */
 
 	if (pauseclose) {	/* pausing here puts peer into FIN_WAIT_2 */
 		if (verbose)
-			fprintf(stderr, "pausing before close\n");
+			vlog("pausing before close\n");
 		sleep_us(pauseclose*1000);
  	}
 
+	PROBE1(conn__close, sockfd);
 	if (close(sockfd) < 0)
 		err_sys("close error");		/* since SO_LINGER may be set */
 }
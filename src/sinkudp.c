@@ -10,25 +10,44 @@
 
 #include <stdio.h>
 #include	"sock.h"
+#include "probes.h"
 
 void
 sink_udp(int sockfd)	/* TODO: use recvfrom ?? */
 {
 	int n, flags;
+	char *buf;
+	uint64_t seq;
+	int64_t delay;
 
 	if (pauseinit)
 		sleep_us(pauseinit*1000);
 	
+	if (owd)
+		owd_init(sockfd);	/* kernel receive timestamps */
+
+	stats_start();
 	for ( ; ; ) {	/* read until peer closes connection; -n opt ignored */
 			/* msgpeek = 0 or MSG_PEEK */
 		flags = msgpeek;
+		buf = rbuf_get(sockfd);	/* rbuf, or borrowed from the pool */
 	oncemore:
-		if ( (n = recv(sockfd, rbuf, readlen, flags)) < 0) {
+		PROBE3(read__start, sockfd, stats.rx_msgs + 1, readlen);
+		iotime_start();
+		if (owd)
+			n = owd_recv(sockfd, buf, readlen);
+		else
+			n = doread_hdr(sockfd, hbuf, iovhdrlen, buf, readlen,
+			    flags);
+		iotime_done();
+		PROBE3(read__done, sockfd, stats.rx_msgs + 1, n);
+		if (n < 0) {
 			err_sys("recv error");
 			
 		} else if (n == 0) {
+			rbuf_put(buf);
 			if (verbose)
-				fprintf(stderr, "connection closed by peer\n");
+				vlog("connection closed by peer\n");
 			break;
 
 #ifdef	notdef		/* following not possible with TCP */
@@ -38,18 +57,33 @@ sink_udp(int sockfd)	/* TODO: use recvfrom ?? */
 	}
 #endif
 
+	if (flags == 0) {	/* don't count MSG_PEEK twice */
+		stats_rx(n);
+		if (timestamp && n >= TSTAMP_LEN) {	/* one per datagram */
+			delay = realtime_ns() - tstamp_get(buf, &seq);
+			tstamp_delay(delay);
+			if (verbose)	/* we never get EOF, so no summary */
+				vlog("seq %llu: delay %.3f ms\n",
+				    (unsigned long long) seq, delay / 1e6);
+		}
+	}
+
 	if (verbose) {
-		fprintf(stderr, "received %d bytes%s\n", n,
+		vlog("received %d bytes%s\n", n,
 			(flags == MSG_PEEK) ? " (MSG_PEEK)" : "");
 		if (verbose > 1) {
+			vlog_flush();	/* the payload goes straight out */
 			fprintf(stderr, "printing %d bytes\n", n);
-			rbuf[n] = 0;	/* make certain it's null terminated */
-			fprintf(stderr, "SDAP header: %lx\n", *((long *) rbuf));
-			fprintf(stderr, "next long: %lx\n", *((long *) rbuf+4));
-			fputs(&rbuf[8], stderr);
+			buf[n] = 0;	/* make certain it's null terminated */
+			fprintf(stderr, "SDAP header: %lx\n", *((long *) buf));
+			fprintf(stderr, "next long: %lx\n", *((long *) buf+4));
+			fputs(&buf[8], stderr);
 		}
 	}
 
+	if (flags == 0)
+		rbuf_put(buf);	/* not held while idle */
+
 	if (pauserw)
 		sleep_us(pauserw*1000);
 
@@ -58,13 +92,15 @@ sink_udp(int sockfd)	/* TODO: use recvfrom ?? */
 		goto oncemore;	/* read the message again */
 	}
 }
+stats_end();
 
 if (pauseclose) {
 	if (verbose)
-		fprintf(stderr, "pausing before close\n");
+		vlog("pausing before close\n");
 	sleep_us(pauseclose*1000);
  }
 
+PROBE1(conn__close, sockfd);
 if (close(sockfd) < 0)
 	err_sys("close error");
 }
@@ -3,16 +3,24 @@
 #include	<sys/time.h>
 #include	<errno.h>
 #include	<stddef.h>
+#include	"sock.h"
 #include	"ourhdr.h"
+#include	"probes.h"
 
 void
 sleep_us(unsigned int nusecs)
 {
 	struct timeval	tval;
+	uint64_t	t0;
 	
+	PROBE1(pause__start, nusecs);
+	/* for --io-time, only the pauses inside a source or sink loop */
+	t0 = (iotime && stats.start_ns != 0 && stats.end_ns == 0) ?
+	    time_ns() : 0;
 	for ( ; ; ) {
 		tval.tv_sec = nusecs / 1000000;
 		tval.tv_usec = nusecs % 1000000;
+		stats_wait();
 		if (select(0, NULL, NULL, NULL, &tval) == 0)
 			break;		/* all OK */
 		/*
@@ -27,4 +35,7 @@ sleep_us(unsigned int nusecs)
 			continue;
 		err_sys("sleep_us: select error");
 	}
+	if (t0 != 0)
+		stats.sleep_ns += time_ns() - t0;
+	PROBE1(pause__done, nusecs);
 }
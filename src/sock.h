@@ -33,6 +33,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -66,26 +67,72 @@ extern int errno;
 #define L4_PROT_UDP	1
 #define L4_PROT_SCTP	2
 
+/* --dest-policy values */
+#define	DEST_WEIGHTED	0
+#define	DEST_RR		1
+#define	DEST_HASH	2
+
+/* --results sections */
+#define	RES_CONFIG	0
+#define	RES_SOCKOPT	1
+#define	RES_INTERVAL	2
+#define	RES_STREAM	3
+#define	RES_TOTAL	4
+
+/* Size of the --timestamp header:  sequence number and send time */
+#define	TSTAMP_LEN	16
+
 #define	min(a,b)	((a) < (b) ? (a) : (b))
 #define	max(a,b)	((a) > (b) ? (a) : (b))
 
 /* declare global variables */
+extern int		ackstamp;
 extern int		af_46;
 extern int		bindport;
+extern int		bufpoolmax;
 extern int		broadcast;
 extern int		cbreak;
 extern int		chunkwrite;
+extern char	       *cclist;
 extern int		client;
+extern char	       *congestion;
 extern int		connectudp;
+extern int		conntimeout;
+extern int		corkwrites;
+extern int		cpsconc;
+extern int		cpsconns;
+extern int		cpspayload;
+extern int		cpsreply;
+extern int		cpsthreads;
+extern int		cpucost;
+extern int		cpumhz;
+extern char	       *cpulist;
 extern int		crlf;
 extern int		debug;
+extern char	       *destlist;
+extern int		destpolicy;
 extern int		dofork;
 extern int		dontroute;
+extern int		fastopen;
 extern int		flowlabel_option;
 extern char		foreignip[];
 extern int		foreignport;
 extern int		halfclose;
+extern int		happyeyeballs;
+extern char	       *hbuf;
 extern int		ignorewerr;
+extern int		iotime;
+extern int		iovcnt;
+extern int		iovhdrlen;
+extern char	       *irqif;
+extern int	       *iovsizes;
+extern int		niovsizes;
+extern int		logdrop;
+extern int		logevery;
+extern int		lograte;
+extern int		numabind;
+extern int		perfevents;
+extern int		nconns;
 extern int		ip_dontfrag;
 extern int		iptos;
 extern int		ipttl;
@@ -95,17 +142,24 @@ extern char		joinip[];
 extern int		keepalive;
 extern long		linger;
 extern int		listenq;
+extern char	       *localaddrs;
 extern char		localip[];
+extern char	       *localports;
 extern int		maxseg;
 extern int		mcastttl;
+extern int		msgmore;
 extern int		msgpeek;
 extern int		nodelay;
 extern int		nbuf;
+extern int		notsentlowat;
 extern int		onesbcast;
+extern int		owd;
 extern int		pauseclose;
 extern int		pauseinit;
 extern int		pauselisten;
 extern int		pauserw;
+extern int		resultscsv;
+extern char	       *resultsfile;
 extern int		reuseaddr;
 extern int		reuseport;
 extern int		readlen;
@@ -118,14 +172,136 @@ extern long		sndtimeo;
 extern char	       *rbuf;
 extern char	       *wbuf;
 extern int		server;
+extern int		sampleint;
+extern int		samplebin;
+extern char	       *samplefile;
+extern char	       *shmname;
+extern int		shmread;
 extern int		sigio;
 extern int		sourcesink;
 extern int		sroute_cnt;
+extern int		timestamp;
+extern int		txstamp;
 extern int		l4_prot;
 extern int		urgwrite;
 extern int		verbose;
 extern int		usewritev;
 
+#define	PERF_NEVENTS	5		/* --perf counters (perf.c) */
+
+/*
+ * Counters kept by the source and sink loops, for the end-of-run summary.
+ */
+struct sockstats {
+	uint64_t	start_ns;	/* time of first read or write */
+	uint64_t	end_ns;		/* time of last read or write */
+	uint64_t	tx_bytes;	/* bytes written */
+	uint64_t	tx_msgs;	/* #writes */
+	uint64_t	tx_errors;	/* failed writes, with -E */
+	uint64_t	rx_bytes;	/* bytes read */
+	uint64_t	rx_msgs;	/* #reads */
+	uint64_t	tx_calls;	/* system calls writing */
+	uint64_t	tx_short;	/* of those, wrote less than asked */
+	uint64_t	tx_eagain;	/* failed with EAGAIN/EWOULDBLOCK */
+	uint64_t	tx_eintr;	/* failed with EINTR */
+	uint64_t	rx_calls;	/* system calls reading */
+	uint64_t	rx_short;	/* of those, read less than asked */
+	uint64_t	rx_eagain;
+	uint64_t	rx_eintr;
+	uint64_t	waits;		/* select()s and poll()s */
+	uint64_t	run_ns;		/* end_ns - start_ns, once ended */
+	uint64_t	io_ops;		/* writes or reads, for --io-time */
+	uint64_t	io_timed;	/* of those, timed */
+	uint64_t	io_ns;		/* time in the timed ones */
+	uint64_t	io_t0;		/* start of the one being timed, or 0 */
+	uint64_t	sleep_ns;	/* in sleep_us(), during the loop */
+	uint64_t	cpu_user_ns;	/* this thread's, for --cpu */
+	uint64_t	cpu_sys_ns;
+	uint64_t	perf[PERF_NEVENTS];	/* for --perf */
+	uint64_t	perfmask;	/* which of perf[] were counted */
+};
+extern __thread struct sockstats stats;
+
+/*
+ * Count a write or read of "n" bytes, or a failed write, in "stats";
+ * with --shm, also in this stream's shared memory slot (shm.c).
+ */
+extern __thread struct shm_slot *shmslot;
+
+#define	stats_tx(n)	do { stats.tx_bytes += (n); stats.tx_msgs++;	\
+			     if (shmslot != NULL) shm_publish(); } while (0)
+#define	stats_rx(n)	do { stats.rx_bytes += (n); stats.rx_msgs++;	\
+			     if (shmslot != NULL) shm_publish(); } while (0)
+#define	stats_txerr()	do { stats.tx_errors++;				\
+			     if (shmslot != NULL) shm_publish(); } while (0)
+
+/*
+ * Count one system call that wrote or read "n" of "asked" bytes, or
+ * failed with errno, in "stats".  A few increments, so it goes around
+ * every write, send, recv etc. in the data path (and in writen() and
+ * the -k chunk loop, once per call).  Use before anything else can
+ * change errno.
+ */
+#define	stats_call(dir, asked, n)	do {			\
+	stats.dir##_calls++;						\
+	if ((n) < 0) {							\
+		if (errno == EINTR)					\
+			stats.dir##_eintr++;				\
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)	\
+			stats.dir##_eagain++;				\
+	} else if ((n) > 0 && (size_t) (n) < (size_t) (asked))		\
+		stats.dir##_short++;					\
+} while (0)
+#define	stats_txcall(asked, n)	stats_call(tx, asked, n)
+#define	stats_rxcall(asked, n)	stats_call(rx, asked, n)
+#define	stats_wait()		(stats.waits++)
+
+/*
+ * Around each write or read in the loops, for --io-time (iotime.c):
+ * time one in every "iotime" of them.
+ */
+#define	iotime_start()	do { if (iotime && ++stats.io_ops % iotime == 0) \
+				stats.io_t0 = time_ns(); } while (0)
+#define	iotime_done()	do { if (stats.io_t0 != 0) iotime_add(); } while (0)
+
+/*
+ * TCP_INFO values that tcpinfo_get() knows how to find on this host;
+ * anything the host doesn't report is 0.
+ */
+struct tcpstat {
+	uint32_t	rtt_us;		/* smoothed RTT */
+	uint32_t	rttvar_us;	/* RTT variance */
+	uint32_t	snd_cwnd;	/* congestion window, segments */
+	uint32_t	snd_mss;
+	uint32_t	snd_wnd;	/* peer's receive window, bytes */
+	uint32_t	retrans;	/* total retransmitted segments */
+	uint32_t	unacked;	/* segments in flight */
+	uint32_t	notsent_bytes;	/* queued but not yet sent */
+	uint64_t	segs_out;
+	uint64_t	segs_in;
+	uint64_t	data_segs_out;	/* segments carrying data */
+	uint64_t	bytes_acked;
+	uint64_t	pacing_rate;	/* bytes/sec */
+	uint64_t	delivery_rate;	/* bytes/sec */
+	uint64_t	busy_us;	/* time with data outstanding */
+	uint64_t	rwnd_limited_us; /* time limited by receive window */
+	uint64_t	sndbuf_limited_us; /* time limited by send buffer */
+	uint32_t	syn_data;	/* data sent with our SYN was acked (TFO) */
+};
+
+/*
+ * Latency histogram (hist.c), values in ns.  Values are kept to within
+ * 1 part in 2^HIST_SUB_BITS.
+ */
+#define	HIST_SUB_BITS	7
+
+struct hist {
+	uint64_t	count;
+	uint64_t	min, max;
+	double		sum, sumsq;
+	uint64_t       *counts;		/* calloc'ed by hist_init() */
+};
+
 extern struct sockaddr_in	cliaddr, servaddr;
 extern struct sockaddr_in	cliaddr4, servaddr4;
 extern struct sockaddr_in6	cliaddr6, servaddr6;
@@ -141,18 +317,87 @@ extern struct sockaddr_in6	cliaddr6, servaddr6;
 #endif
 
 				/* function prototypes */
+void	affinity_init(void);
+void	affinity_thread(void);
+void	affinity_fork(void);
+void	affinity_report(void);
 void	buffers(int);
+void	bufpool_init(size_t, int);
+char   *bufpool_get(void);
+void	bufpool_put(char *);
+void	bufpool_report(void);
+char   *rbuf_get(int);
+void	rbuf_put(char *);
+void	cc_compare(char *, char *);
+void	cc_sample(int);
+void	cpu_start(void);
+void	cpu_thread_start(void);
+void	cpu_thread_end(void);
+int	cpu_thread_usage(uint64_t *, uint64_t *);
+void	cpu_report(const struct sockstats *);
 int     cliopen(char *, char *);
+void	cli_resolve(char *, char *);
+struct sockaddr *cli_servaddr(socklen_t *);
+int	cli_socket(void);
+void	cli_connect(int);
+void	cli_connected(int);
+void	conn_run(char *, char *);
+void	conn_serve(int);
+void	cork_init(int);
+void	fanout_init(char *);
+int	fanout_flows(void);
+int	fanout_pick(int, int, struct sockaddr **, socklen_t *);
+void	fanout_account(int, int, const struct sockstats *);
+void	fanout_report(void);
+const char *fanout_name(int);
+ssize_t	cork_write(int, const void *, size_t, const void *, size_t);
+void	cork_flush(int);
+void	cork_report(int);
+void	cps_run(char *, char *);
+void	hist_init(struct hist *);
+void	hist_add(struct hist *, uint64_t);
+void	hist_merge(struct hist *, const struct hist *);
+uint64_t hist_pct(const struct hist *, double);
+void	hist_report(const struct hist *, const char *);
+void	hist_hgrm(const struct hist *, FILE *);
 int	crlf_add(char *, int, const char *, int);
 int	crlf_strip(char *, int, const char *, int);
 void	join_mcast_server(int, struct sockaddr_in *, struct sockaddr_in6 *);
 void	join_mcast_client(int, struct sockaddr_in *, struct sockaddr_in6 *,
 			  struct sockaddr_in *, struct sockaddr_in6 *);
+void	iotime_add(void);
+void	iotime_merge(void);
+void	iotime_report(const struct sockstats *);
+void	livestats_start(void);
+void	perf_init(void);
+void	perf_thread_start(void);
+void	perf_thread_end(void);
+void	perf_report(const struct sockstats *);
 void	loop_tcp(int);
 void	loop_udp(int);
 void	loop_sctp(int);
+void	owd_sync(int);
+void	owd_finish(int);
+void	owd_init(int);
+int	owd_recv(int, char *, int);
+void	owd_live(void);
+void	owd_report(void);
 void	pattern(char *, int);
+void	results_init(char *, char *);
+void	results_sockopts(int);
+void	results_str(int, int, const char *, const char *);
+void	results_u64(int, int, const char *, uint64_t);
+void	results_dbl(int, int, const char *, double);
+void	results_write(void);
 int		servopen(char *, char *);
+void	sampler_start(int);
+void	sampler_stop(void);
+void	shm_init(int, char *, char *);
+void	shm_publish(void);
+void	shm_read(int, char **);
+void	shm_remove(void);
+void	shm_stream_start(void);
+void	shm_stream_end(void);
 void	sink_tcp(int);
 void	sink_udp(int);
 void	sink_sctp(int);
@@ -164,6 +409,43 @@ void	sroute_set(int);
 void	sleep_us(unsigned int);
 void	sockopts(int, int);
 ssize_t	dowrite(int, const void *, size_t);
+ssize_t	dowrite_hdr(int, const void *, size_t, const void *, size_t);
+ssize_t	dosend_hdr(int, const void *, size_t, const void *, size_t, int);
+ssize_t	doread_hdr(int, void *, size_t, void *, size_t, int);
+int	iov_count(void);
+int	iov_max(void);
+int	iov_fill(struct iovec *, const void *, size_t, const void *, size_t);
+struct iovec *iov_get(void);
+uint64_t time_ns(void);
+int	tcpinfo_get(int, struct tcpstat *);
+int	tcpinfo_drain(int, struct tcpstat *);
+void	fastopen_report(int);
+uint64_t realtime_ns(void);
+void	put64(char *, uint64_t);
+uint64_t get64(const char *);
+void	tstamp_put(char *);
+uint64_t tstamp_get(const char *, uint64_t *);
+void	tstamp_delay(int64_t);
+void	tstamp_stream(const char *, int, int);
+void	tstamp_report(void);
+void	txstamp_init(int);
+ssize_t	txstamp_write(int, const void *, size_t);
+void	txstamp_live(void);
+void	txstamp_report(int);
+void	lowat_init(int);
+ssize_t	lowat_write(int, const void *, size_t);
+void	lowat_report(void);
+void	srcpool_init(char *, char *);
+int	srcpool_bind(int);
+int	srcpool_exhausted(int);
+void	stats_start(void);
+void	stats_end(void);
+void	stats_report(void);
+void	stats_add(struct sockstats *, const struct sockstats *);
+int	stats_snapshot(struct sockstats *);
+void	vlog(const char *, ...);
+void	vlog_flush(void);
+void	vlog_start(void);
 int	ipv6_set_hopopts_ext_hdr(int fd, int num_hdr_opts);
 int	ipv6_set_dstopts_ext_hdr(int fd, int num_hdr_opts);
 int	ipv6_set_rthdrs_ext_hdr(int fd, int num_hdr_opts);
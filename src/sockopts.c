@@ -268,6 +268,63 @@ sockopts(int sockfd, int doall)
 			fprintf(stderr, "TCP_MAXSEG = %d\n", option);
 	}
 	
+	if (congestion != NULL && doall == 0 && l4_prot == L4_PROT_TCP) {
+#ifdef	TCP_CONGESTION
+		char	name[64];
+
+		/*
+		 * Set before connect() or listen(); a connected socket
+		 * from accept() inherits it from the listening socket.
+		 */
+		if (setsockopt(sockfd, IPPROTO_TCP, TCP_CONGESTION,
+			       congestion, strlen(congestion)) < 0)
+			err_sys("TCP_CONGESTION setsockopt error (%s)",
+				congestion);
+
+		bzero(name, sizeof(name));
+		optlen = sizeof(name) - 1;
+		if (getsockopt(sockfd, IPPROTO_TCP, TCP_CONGESTION,
+			       name, &optlen) < 0)
+			err_sys("TCP_CONGESTION getsockopt error");
+		if (strcmp(name, congestion) != 0)
+			err_quit("TCP_CONGESTION not set (%s)", name);
+
+		if (verbose)
+			fprintf(stderr, "TCP_CONGESTION = %s\n", name);
+#else
+		err_quit("TCP_CONGESTION not supported by host");
+#endif
+	}
+
+	/*
+	 * TCP Fast Open.  The server's listening socket gets a queue of
+	 * "fastopen" pending TFO connections; the client's first write
+	 * then goes with the SYN, once it has a cookie from the server.
+	 * The --cps client sends its first write with MSG_FASTOPEN itself.
+	 */
+	if (fastopen && doall == 0 && l4_prot == L4_PROT_TCP) {
+		if (!client) {
+#ifdef	TCP_FASTOPEN
+			if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN,
+				       &fastopen, sizeof(fastopen)) < 0)
+				err_sys("TCP_FASTOPEN setsockopt error");
+			if (verbose)
+				fprintf(stderr, "TCP_FASTOPEN = %d\n", fastopen);
+#else
+			err_quit("TCP_FASTOPEN not supported by host");
+#endif
+		} else if (!cpsconns) {
+#ifdef	TCP_FASTOPEN_CONNECT
+			option = 1;
+			if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+				       &option, sizeof(option)) < 0)
+				err_sys("TCP_FASTOPEN_CONNECT setsockopt error");
+#else
+			err_quit("TCP_FASTOPEN_CONNECT not supported by host");
+#endif
+		}
+	}
+
 	if (sroute_cnt > 0)
 		sroute_set(sockfd);
 	
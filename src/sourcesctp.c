@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include "sock.h"
+#include "probes.h"
 
 /*
  * Invoked for an SCTP client when sourcesink is set by the -i option.
@@ -18,21 +19,34 @@
 void
 source_sctp(int sockfd)
 {
-	int		i, n, option;
+	int		i, n, option, wlen;
 	socklen_t	optlen;
 
 	/* Fill send buffer with a pattern. */
 	pattern(wbuf, writelen);
+	/* header (--iov-hdr) + data */
+	wlen = iovhdrlen + writelen;
 
 	if (pauseinit) {
 		sleep_us(pauseinit * 1000);
 	}
 
+	stats_start();
 	for (i = 1; i <= nbuf; i++) {
-		if ( (n = write(sockfd, wbuf, writelen)) != writelen) {
+		if (timestamp) {
+			/* sequence# and send time */
+			tstamp_put(wbuf);
+		}
+		PROBE3(write__start, sockfd, i, wlen);
+		iotime_start();
+		n = dowrite_hdr(sockfd, hbuf, iovhdrlen, wbuf, writelen);
+		iotime_done();
+		PROBE3(write__done, sockfd, i, n);
+		if (n != wlen) {
 			if (ignorewerr) {
+				stats_txerr();
 				err_ret("write returned %d, expected %d",
-				    n, writelen);
+				    n, wlen);
 				/* also call getsockopt() to clear so_error */
 				optlen = sizeof(option);
 				if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR,
@@ -41,22 +55,30 @@ source_sctp(int sockfd)
 				}
 			} else {
 				err_sys("write returned %d, expected %d", n,
-				    writelen);
+				    wlen);
 			}
 		} else if (verbose) {
-			fprintf(stderr, "wrote %d bytes\n", n);
+			vlog("wrote %d bytes\n", n);
+		}
+		if (n > 0) {
+			stats_tx(n);
 		}
 		if (pauserw) {
 			sleep_us(pauserw * 1000);
 		}
 	}
+	stats_end();
+
+	if (sampleint)
+		sampler_stop();		/* before close() */
 
 	if (pauseclose) {
 		if (verbose) {
-			fprintf(stderr, "pausing before close\n");
+			vlog("pausing before close\n");
 		}
 		sleep_us(pauseclose * 1000);
 	}
+	PROBE1(conn__close, sockfd);
 	if (close(sockfd) < 0) {
 		err_sys("close error");
 	}
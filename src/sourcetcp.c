@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include "sock.h"
+#include "probes.h"
 
 /*
  * Invoked for a TCP client when sourcesink is set by the -i option.
@@ -17,15 +18,24 @@
 void
 source_tcp(int sockfd)
 {
-	int		i, n, option;
+	int		i, n, option, wlen;
 	socklen_t	optlen;
 	char		oob;
 
 	pattern(wbuf, writelen);	/* fill send buffer with a pattern */
+	wlen = iovhdrlen + writelen;	/* header (--iov-hdr) + data */
 
 	if (pauseinit)
 		sleep_us(pauseinit*1000);
 
+	if (corkwrites || msgmore)
+		cork_init(sockfd);
+	if (notsentlowat)
+		lowat_init(sockfd);
+	if (txstamp || ackstamp)
+		txstamp_init(sockfd);
+
+	stats_start();
 	for (i = 1; i <= nbuf; i++) {
 		/*
 		 * urgwrite is set to "n" by the "-U n" option.
@@ -36,37 +46,74 @@ source_tcp(int sockfd)
 		 */
 		if (urgwrite == i) {
 			oob = urgwrite;
-			if ( (n = send(sockfd, &oob, 1, MSG_OOB)) != 1)
+			n = send(sockfd, &oob, 1, MSG_OOB);
+			stats_txcall(1, n);
+			if (n != 1)
 				err_sys("send of MSG_OOB returned %d, expected %d",
 					n, writelen);
 			if (verbose)
-				fprintf(stderr, "wrote %d byte of urgent data\n", n);
+				vlog("wrote %d byte of urgent data\n", n);
 		}
 
-		if ( (n = write(sockfd, wbuf, writelen)) != writelen) {
+		if (timestamp)
+			tstamp_put(wbuf);	/* sequence# and send time */
+
+		PROBE3(write__start, sockfd, i, wlen);
+		iotime_start();
+		if (corkwrites || msgmore)	/* batched small writes */
+			n = cork_write(sockfd, hbuf, iovhdrlen, wbuf, writelen);
+		else if (notsentlowat)		/* non-blocking */
+			n = lowat_write(sockfd, wbuf, writelen);
+		else if (txstamp || ackstamp)	/* transmit timestamps */
+			n = txstamp_write(sockfd, wbuf, writelen);
+		else
+			n = dowrite_hdr(sockfd, hbuf, iovhdrlen, wbuf, writelen);
+		iotime_done();
+		PROBE3(write__done, sockfd, i, n);
+		if (n != wlen) {
 			if (ignorewerr) {
-				err_ret("write returned %d, expected %d", n, writelen);
+				stats_txerr();
+				err_ret("write returned %d, expected %d", n, wlen);
 				/* also call getsockopt() to clear so_error */
 				optlen = sizeof(option);
        			if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR,
 				       &option, &optlen) < 0)
            			err_sys("SO_ERROR getsockopt error");
 			} else
-				err_sys("write returned %d, expected %d", n, writelen);
+				err_sys("write returned %d, expected %d", n, wlen);
 
 		} else if (verbose)
-			fprintf(stderr, "wrote %d bytes\n", n);
+			vlog("wrote %d bytes\n", n);
+		if (n > 0) {
+			stats_tx(n);
+		}
 
 		if (pauserw)
 			sleep_us(pauserw*1000);
 	}
+	stats_end();
+
+	if (corkwrites || msgmore)
+		cork_report(sockfd);
+	if (notsentlowat)
+		lowat_report();
+	if (txstamp || ackstamp)
+		txstamp_report(sockfd);
+	if (cclist != NULL)
+		cc_sample(sockfd);	/* TCP_INFO before close() */
+	if (fastopen)
+		fastopen_report(sockfd);
+
+	if (sampleint)
+		sampler_stop();		/* before close() */
 
 	if (pauseclose) {
 		if (verbose)
-			fprintf(stderr, "pausing before close\n");
+			vlog("pausing before close\n");
 		sleep_us(pauseclose*1000);
 	}
 
+	PROBE1(conn__close, sockfd);
 	if (close(sockfd) < 0)
 		err_sys("close error");		/* since SO_LINGER may be set */
 }
@@ -13,24 +13,45 @@
 
 #include <stdio.h>
 #include "sock.h"
+#include "probes.h"
 
 void
 source_udp(int sockfd)	/* TODO: use sendto ?? */
 {
-	int		i, n, option;
+	int		i, n, option, wlen;
 	socklen_t	optlen;
 
 	pattern(wbuf, writelen);	/* fill send buffer with a pattern */
+	wlen = iovhdrlen + writelen;	/* header (--iov-hdr) + data */
 
 	if (pauseinit)
 		sleep_us(pauseinit*1000);
 
+	if (owd)
+		owd_sync(sockfd);	/* clock offset, before any data */
+	if (txstamp)
+		txstamp_init(sockfd);
+
+	stats_start();
 	for (i = 1; i <= nbuf; i++) {
+		if (timestamp)
+			tstamp_put(wbuf);	/* sequence# and send time */
+
+		PROBE3(write__start, sockfd, i, wlen);
+		iotime_start();
 		if (connectudp) {
-			if ( (n = write(sockfd, wbuf, writelen)) != writelen) {
+			if (txstamp)	/* transmit timestamps */
+				n = txstamp_write(sockfd, wbuf, writelen);
+			else
+				n = dowrite_hdr(sockfd, hbuf, iovhdrlen,
+				    wbuf, writelen);
+			iotime_done();
+			PROBE3(write__done, sockfd, i, n);
+			if (n != wlen) {
 				if (ignorewerr) {
+					stats_txerr();
 					err_ret("write returned %d, expected %d",
-					    n, writelen);
+					    n, wlen);
 					/* also call getsockopt() to clear so_error */
 					optlen = sizeof(option);
 					if (getsockopt(sockfd, SOL_SOCKET,
@@ -38,7 +59,7 @@ source_udp(int sockfd)	/* TODO: use sendto ?? */
 						err_sys("SO_ERROR getsockopt error");
 				} else {
 					err_sys("write returned %d, expected %d",
-					    n, writelen);
+					    n, wlen);
 				}
 			}
 		} else {
@@ -51,8 +72,12 @@ source_udp(int sockfd)	/* TODO: use sendto ?? */
 				   (struct sockaddr *) &servaddr6,
 				   sizeof(servaddr6));
 			}
+			stats_txcall(writelen, n);
+			iotime_done();
+			PROBE3(write__done, sockfd, i, n);
 			if (n != writelen) {
 				if (ignorewerr) {
+					stats_txerr();
 					err_ret("sendto returned %d, expected %d",
 					    n, writelen);
 					/* also call getsockopt() to clear so_error */
@@ -68,18 +93,28 @@ source_udp(int sockfd)	/* TODO: use sendto ?? */
 		}
 
 		if (verbose)
-			fprintf(stderr, "wrote %d bytes\n", n);
+			vlog("wrote %d bytes\n", n);
+		if (n > 0) {
+			stats_tx(n);
+		}
 
 		if (pauserw)
 			sleep_us(pauserw*1000);
 	}
+	stats_end();
+
+	if (txstamp)
+		txstamp_report(sockfd);
+	if (owd)
+		owd_finish(sockfd);	/* sink stops at end-of-data */
 
 	if (pauseclose) {
 		if (verbose)
-			fprintf(stderr, "pausing before close\n");
+			vlog("pausing before close\n");
 		sleep_us(pauseclose*1000);
 	}
 
+	PROBE1(conn__close, sockfd);
 	if (close(sockfd) < 0)
 		err_sys("close error");		/* since SO_LINGER may be set */
 }
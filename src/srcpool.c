@@ -0,0 +1,178 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Pool of local addresses for the client, with --local-addrs.  A single
+ * source address has only so many ephemeral ports, and a high rate of
+ * short connections to one server uses them up (each closed connection
+ * holds its port in TIME_WAIT).  Spreading the connections over several
+ * local addresses multiplies the number of 4-tuples available.
+ *
+ * The list is comma-separated addresses or ranges "first-last", IPv4 or
+ * (with -6) IPv6; each new socket is bound to the next address in turn.
+ * By default the port is left to the kernel with IP_BIND_ADDRESS_NO_PORT,
+ * which defers choosing it until connect(), when the whole 4-tuple is
+ * known, so the same port can be used towards different servers.  With
+ * --local-ports lo-hi the ports are also bound explicitly, cycling
+ * through every address and port pair.
+ */
+
+#include "sock.h"
+
+struct srcrange {
+	struct sockaddr_storage	first;
+	uint64_t		count;		/* #addresses in the range */
+};
+
+static struct srcrange	*ranges;
+static int		 nranges;
+static uint64_t		 naddrs;	/* total over all ranges */
+static int		 portlo, nports;	/* --local-ports */
+static uint64_t		 next;		/* next address/port to use */
+
+/*
+ * Parse one address into "ss".  Returns 0, or -1 if it isn't one.
+ */
+static int
+srcpool_addr(char *str, struct sockaddr_storage *ss)
+{
+	struct sockaddr_in	*sin = (struct sockaddr_in *) ss;
+	struct sockaddr_in6	*sin6 = (struct sockaddr_in6 *) ss;
+
+	bzero(ss, sizeof(*ss));
+	if (af_46 == AF_INET) {
+		sin->sin_family = AF_INET;
+		return(inet_pton(AF_INET, str, &sin->sin_addr) == 1 ? 0 : -1);
+	}
+	sin6->sin6_family = AF_INET6;
+	sin6->sin6_len = sizeof(struct sockaddr_in6);
+	return(inet_pton(AF_INET6, str, &sin6->sin6_addr) == 1 ? 0 : -1);
+}
+
+/*
+ * The low 64 bits of the address (all of it for IPv4), as a number.
+ */
+static uint64_t
+srcpool_low(const struct sockaddr_storage *ss)
+{
+	if (ss->ss_family == AF_INET)
+		return(ntohl(((struct sockaddr_in *) ss)->sin_addr.s_addr));
+	return(get64((char *) &((struct sockaddr_in6 *) ss)->sin6_addr + 8));
+}
+
+static void
+srcpool_setlow(struct sockaddr_storage *ss, uint64_t v)
+{
+	if (ss->ss_family == AF_INET)
+		((struct sockaddr_in *) ss)->sin_addr.s_addr = htonl(v);
+	else
+		put64((char *) &((struct sockaddr_in6 *) ss)->sin6_addr + 8, v);
+}
+
+void
+srcpool_init(char *addrs, char *ports)
+{
+	struct sockaddr_storage	last;
+	char			*list, *tok, *dash;
+	uint64_t		 lo, hi;
+	int			 porthi;
+
+	if ( (list = strdup(addrs)) == NULL)
+		err_sys("strdup error");
+	for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if ( (ranges = realloc(ranges,
+		    (nranges + 1) * sizeof(struct srcrange))) == NULL)
+			err_sys("realloc error for --local-addrs");
+		if ( (dash = strchr(tok, '-')) != NULL)
+			*dash++ = 0;
+		if (srcpool_addr(tok, &ranges[nranges].first) < 0)
+			err_quit("invalid %s address in --local-addrs: %s",
+			    af_46 == AF_INET ? "IPv4" : "IPv6", tok);
+		ranges[nranges].count = 1;
+		if (dash != NULL) {
+			if (srcpool_addr(dash, &last) < 0)
+				err_quit("invalid %s address in --local-addrs: %s",
+				    af_46 == AF_INET ? "IPv4" : "IPv6", dash);
+			if (af_46 == AF_INET6 &&
+			    memcmp(&((struct sockaddr_in6 *) &last)->sin6_addr,
+			    &((struct sockaddr_in6 *)
+			    &ranges[nranges].first)->sin6_addr, 8) != 0)
+				err_quit("--local-addrs range %s-%s spans more "
+				    "than a /64", tok, dash);
+			lo = srcpool_low(&ranges[nranges].first);
+			hi = srcpool_low(&last);
+			if (hi < lo)
+				err_quit("--local-addrs range %s-%s is backwards",
+				    tok, dash);
+			ranges[nranges].count = hi - lo + 1;
+		}
+		naddrs += ranges[nranges].count;
+		nranges++;
+	}
+	free(list);
+	if (naddrs == 0)
+		err_quit("empty --local-addrs list");
+
+	if (ports != NULL) {
+		if (sscanf(ports, "%d-%d", &portlo, &porthi) != 2 ||
+		    portlo <= 0 || porthi > 65535 || porthi < portlo)
+			err_quit("invalid --local-ports range: %s", ports);
+		nports = porthi - portlo + 1;
+	}
+	if (verbose)
+		fprintf(stderr, "local address pool:  %llu addresses, %s\n",
+		    (unsigned long long) naddrs, nports ? ports :
+		    "ports chosen at connect()");
+}
+
+/*
+ * Bind "sockfd" to the next local address (and port) in the pool.
+ * Safe to call from several threads at once.  Returns as for bind().
+ */
+int
+srcpool_bind(int sockfd)
+{
+	struct sockaddr_storage	ss;
+	uint64_t		k, i;
+	int			r, port;
+
+	k = __sync_fetch_and_add(&next, 1);
+	if (nports) {
+		k %= naddrs * nports;
+		port = portlo + k / naddrs;	/* all addresses, then next port */
+		k %= naddrs;
+	} else {
+		k %= naddrs;
+		port = 0;
+#ifdef	IP_BIND_ADDRESS_NO_PORT
+		{
+		int	on = 1;
+
+		if (setsockopt(sockfd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT,
+			       &on, sizeof(on)) < 0)
+			err_sys("IP_BIND_ADDRESS_NO_PORT setsockopt error");
+		}
+#endif
+	}
+
+	for (r = 0; k >= ranges[r].count; r++)
+		k -= ranges[r].count;
+	ss = ranges[r].first;
+	i = srcpool_low(&ss);
+	srcpool_setlow(&ss, i + k);
+	if (ss.ss_family == AF_INET) {
+		((struct sockaddr_in *) &ss)->sin_port = htons(port);
+		return(bind(sockfd, (struct sockaddr *) &ss,
+		    sizeof(struct sockaddr_in)));
+	}
+	((struct sockaddr_in6 *) &ss)->sin6_port = htons(port);
+	return(bind(sockfd, (struct sockaddr *) &ss,
+	    sizeof(struct sockaddr_in6)));
+}
+
+/*
+ * Did a bind() or connect() fail for want of a local port?
+ */
+int
+srcpool_exhausted(int err)
+{
+	return(err == EADDRNOTAVAIL || err == EADDRINUSE);
+}
@@ -0,0 +1,226 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Byte and message counters for the source and sink loops, and the
+ * end-of-run summary printed from them.
+ *
+ * While a loop runs, its thread's counters are also on a list, so that
+ * stats_snapshot() can add them up from another thread (for SIGUSR1);
+ * once it's done they are moved into "retired".
+ */
+
+#include <time.h>
+#include <pthread.h>
+#include "sock.h"
+
+__thread struct sockstats stats;	/* per thread, for --conns */
+
+static pthread_mutex_t	  live_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sockstats	**live;		/* of running loops */
+static int		  nlive, maxlive;
+static struct sockstats	  retired;	/* loops that have finished */
+
+/*
+ * Monotonic time in nanoseconds, for measuring intervals.
+ */
+uint64_t
+time_ns(void)
+{
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		err_sys("clock_gettime error");
+	return((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Add the counters (not the times) of "from" into "to".
+ */
+void
+stats_add(struct sockstats *to, const struct sockstats *from)
+{
+	int	i;
+
+	to->tx_bytes += from->tx_bytes;
+	to->tx_msgs += from->tx_msgs;
+	to->tx_errors += from->tx_errors;
+	to->rx_bytes += from->rx_bytes;
+	to->rx_msgs += from->rx_msgs;
+	to->tx_calls += from->tx_calls;
+	to->tx_short += from->tx_short;
+	to->tx_eagain += from->tx_eagain;
+	to->tx_eintr += from->tx_eintr;
+	to->rx_calls += from->rx_calls;
+	to->rx_short += from->rx_short;
+	to->rx_eagain += from->rx_eagain;
+	to->rx_eintr += from->rx_eintr;
+	to->waits += from->waits;
+	to->run_ns += from->run_ns;
+	to->io_ops += from->io_ops;
+	to->io_timed += from->io_timed;
+	to->io_ns += from->io_ns;
+	to->sleep_ns += from->sleep_ns;
+	to->cpu_user_ns += from->cpu_user_ns;
+	to->cpu_sys_ns += from->cpu_sys_ns;
+	for (i = 0; i < PERF_NEVENTS; i++)
+		to->perf[i] += from->perf[i];
+	to->perfmask |= from->perfmask;
+}
+
+/* Called just before the first read or write of the run. */
+void
+stats_start(void)
+{
+	affinity_thread();		/* --cpus, before anything is timed */
+	stats.start_ns = time_ns();
+	if (cpucost)
+		cpu_thread_start();	/* --cpu */
+
+	pthread_mutex_lock(&live_lock);
+	if (nlive == maxlive) {
+		maxlive = maxlive ? 2 * maxlive : 16;
+		if ( (live = realloc(live,
+		    maxlive * sizeof(struct sockstats *))) == NULL)
+			err_sys("realloc error");
+	}
+	live[nlive++] = &stats;
+	if (retired.start_ns == 0 || stats.start_ns < retired.start_ns)
+		retired.start_ns = stats.start_ns;
+	pthread_mutex_unlock(&live_lock);
+
+	shm_stream_start();		/* with --shm */
+	if (perfevents)
+		perf_thread_start();	/* --perf, last before the loop */
+}
+
+/* Called just after the last read or write of the run. */
+void
+stats_end(void)
+{
+	int	i;
+
+	if (perfevents)
+		perf_thread_end();	/* first after the loop */
+	stats.end_ns = time_ns();
+	if (cpucost)
+		cpu_thread_end();
+	stats.run_ns = stats.end_ns - stats.start_ns;
+	shm_stream_end();
+	iotime_merge();			/* with --io-time */
+
+	/* before the thread exits, and its "stats" goes away */
+	pthread_mutex_lock(&live_lock);
+	for (i = 0; i < nlive; i++) {
+		if (live[i] == &stats) {
+			live[i] = live[--nlive];
+			stats_add(&retired, &stats);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&live_lock);
+}
+
+/*
+ * Add up the counters of every loop so far, running or not, into
+ * "sum", from any thread.  The running ones are read as they are being
+ * updated, so may be a write or two behind.  Returns the number of
+ * loops still running.
+ */
+int
+stats_snapshot(struct sockstats *sum)
+{
+	struct sockstats	*s;
+	int			 i, n;
+
+	pthread_mutex_lock(&live_lock);
+	*sum = retired;
+	for (i = 0; i < nlive; i++) {
+		s = live[i];
+#define	LOAD(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+		sum->tx_bytes += LOAD(s->tx_bytes);
+		sum->tx_msgs += LOAD(s->tx_msgs);
+		sum->tx_errors += LOAD(s->tx_errors);
+		sum->rx_bytes += LOAD(s->rx_bytes);
+		sum->rx_msgs += LOAD(s->rx_msgs);
+#undef	LOAD
+	}
+	n = nlive;
+	pthread_mutex_unlock(&live_lock);
+	return(n);
+}
+
+static void
+stats_report_dir(int tx, uint64_t nbytes, uint64_t nmsgs, double secs)
+{
+	fprintf(stderr, "%s %llu bytes in %llu %s",
+	    tx ? "sent" : "received", (unsigned long long) nbytes,
+	    (unsigned long long) nmsgs, tx ? "writes" : "reads");
+	if (secs > 0)
+		fprintf(stderr, ", %.3f sec, %.3f Mbit/s",
+		    secs, nbytes * 8 / secs / 1e6);
+	if (usewritev)
+		fprintf(stderr, ", %d iovecs per %s",
+		    iov_count(), tx ? "writev" : "readv");
+	if (iovhdrlen)
+		fprintf(stderr, " plus %d-byte header", iovhdrlen);
+	fprintf(stderr, "\n");
+}
+
+/*
+ * System calls for one direction:  how many per MB moved, how much each
+ * moved on average, and how many came up short or failed with EAGAIN
+ * or EINTR.  Chunked writes (-k), writen() retries and send buffer
+ * waits (--notsent-lowat) all show up here.
+ */
+static void
+stats_report_calls(int tx, uint64_t nbytes, uint64_t calls, uint64_t nshort,
+    uint64_t eagain, uint64_t eintr)
+{
+	if (calls == 0)
+		return;
+	fprintf(stderr, "%s calls: %llu", tx ? "write" : "read",
+	    (unsigned long long) calls);
+	if (nbytes > 0)
+		fprintf(stderr, " (%.1f per MB, %.1f bytes per call)",
+		    calls / (nbytes / 1e6), (double) nbytes / calls);
+	fprintf(stderr, ", %llu short, %llu EAGAIN, %llu EINTR\n",
+	    (unsigned long long) nshort, (unsigned long long) eagain,
+	    (unsigned long long) eintr);
+}
+
+/*
+ * Print the totals for the run.
+ */
+void
+stats_report(void)
+{
+	double	secs;
+
+	if (stats.start_ns == 0)
+		return;		/* not a source or sink run */
+	if (stats.end_ns == 0)
+		stats_end();
+	vlog_flush();		/* the -v lines come first */
+	secs = (stats.end_ns - stats.start_ns) / 1e9;
+
+	if (stats.tx_msgs)
+		stats_report_dir(1, stats.tx_bytes, stats.tx_msgs, secs);
+	if (stats.rx_msgs)
+		stats_report_dir(0, stats.rx_bytes, stats.rx_msgs, secs);
+	if (stats.tx_errors)
+		fprintf(stderr, "%llu write errors\n",
+		    (unsigned long long) stats.tx_errors);
+	stats_report_calls(1, stats.tx_bytes, stats.tx_calls, stats.tx_short,
+	    stats.tx_eagain, stats.tx_eintr);
+	stats_report_calls(0, stats.rx_bytes, stats.rx_calls, stats.rx_short,
+	    stats.rx_eagain, stats.rx_eintr);
+	if (stats.waits)
+		fprintf(stderr, "%llu select()/poll() waits\n",
+		    (unsigned long long) stats.waits);
+	if (iotime)
+		iotime_report(&stats);
+	if (cpucost)
+		cpu_report(&stats);
+	if (perfevents)
+		perf_report(&stats);
+	affinity_report();		/* with --cpus or --irq-cpus */
+}
@@ -0,0 +1,190 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Read the kernel's per-connection TCP statistics (TCP_INFO) into a
+ * struct tcpstat, which has the same meaning on every host.
+ *
+ * The struct tcp_info in glibc's <netinet/tcp.h> stops at
+ * tcpi_total_retrans, and <linux/tcp.h> can't be included along with
+ * <netinet/tcp.h>, so on Linux we use our own copy of the kernel's
+ * layout.  The kernel copies out as much of it as it knows about and
+ * returns that length; fields it didn't fill in are left 0.
+ */
+
+#include "sock.h"
+
+#if	defined(TCP_INFO) && defined(__linux__)
+#ifndef	TCPI_OPT_SYN_DATA
+#define	TCPI_OPT_SYN_DATA	32	/* SYN-ACK acked data in SYN */
+#endif
+
+struct linux_tcp_info {
+	uint8_t		tcpi_state;
+	uint8_t		tcpi_ca_state;
+	uint8_t		tcpi_retransmits;
+	uint8_t		tcpi_probes;
+	uint8_t		tcpi_backoff;
+	uint8_t		tcpi_options;
+	uint8_t		tcpi_snd_wscale : 4, tcpi_rcv_wscale : 4;
+	uint8_t		tcpi_delivery_rate_app_limited : 1,
+			tcpi_fastopen_client_fail : 2;
+
+	uint32_t	tcpi_rto;
+	uint32_t	tcpi_ato;
+	uint32_t	tcpi_snd_mss;
+	uint32_t	tcpi_rcv_mss;
+
+	uint32_t	tcpi_unacked;
+	uint32_t	tcpi_sacked;
+	uint32_t	tcpi_lost;
+	uint32_t	tcpi_retrans;
+	uint32_t	tcpi_fackets;
+
+	uint32_t	tcpi_last_data_sent;
+	uint32_t	tcpi_last_ack_sent;
+	uint32_t	tcpi_last_data_recv;
+	uint32_t	tcpi_last_ack_recv;
+
+	uint32_t	tcpi_pmtu;
+	uint32_t	tcpi_rcv_ssthresh;
+	uint32_t	tcpi_rtt;
+	uint32_t	tcpi_rttvar;
+	uint32_t	tcpi_snd_ssthresh;
+	uint32_t	tcpi_snd_cwnd;
+	uint32_t	tcpi_advmss;
+	uint32_t	tcpi_reordering;
+
+	uint32_t	tcpi_rcv_rtt;
+	uint32_t	tcpi_rcv_space;
+
+	uint32_t	tcpi_total_retrans;
+
+	uint64_t	tcpi_pacing_rate;
+	uint64_t	tcpi_max_pacing_rate;
+	uint64_t	tcpi_bytes_acked;
+	uint64_t	tcpi_bytes_received;
+	uint32_t	tcpi_segs_out;
+	uint32_t	tcpi_segs_in;
+
+	uint32_t	tcpi_notsent_bytes;
+	uint32_t	tcpi_min_rtt;
+	uint32_t	tcpi_data_segs_in;
+	uint32_t	tcpi_data_segs_out;
+
+	uint64_t	tcpi_delivery_rate;
+
+	uint64_t	tcpi_busy_time;
+	uint64_t	tcpi_rwnd_limited;
+	uint64_t	tcpi_sndbuf_limited;
+
+	uint32_t	tcpi_delivered;
+	uint32_t	tcpi_delivered_ce;
+
+	uint64_t	tcpi_bytes_sent;
+	uint64_t	tcpi_bytes_retrans;
+	uint32_t	tcpi_dsack_dups;
+	uint32_t	tcpi_reord_seen;
+
+	uint32_t	tcpi_rcv_ooopack;
+
+	uint32_t	tcpi_snd_wnd;
+};
+#endif
+
+/*
+ * Fill in "ts" for the TCP connection "sockfd".  Returns 0, or -1 if the
+ * host doesn't support TCP_INFO (with errno set).
+ */
+int
+tcpinfo_get(int sockfd, struct tcpstat *ts)
+{
+	bzero(ts, sizeof(*ts));
+
+#if	defined(TCP_INFO) && defined(__linux__)
+	{
+	struct linux_tcp_info	ti;
+	socklen_t		optlen;
+
+	bzero(&ti, sizeof(ti));
+	optlen = sizeof(ti);
+	if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &ti, &optlen) < 0)
+		return(-1);
+
+	ts->rtt_us = ti.tcpi_rtt;
+	ts->rttvar_us = ti.tcpi_rttvar;
+	ts->snd_cwnd = ti.tcpi_snd_cwnd;
+	ts->snd_mss = ti.tcpi_snd_mss;
+	ts->snd_wnd = ti.tcpi_snd_wnd;
+	ts->retrans = ti.tcpi_total_retrans;
+	ts->unacked = ti.tcpi_unacked;
+	ts->notsent_bytes = ti.tcpi_notsent_bytes;
+	ts->segs_out = ti.tcpi_segs_out;
+	ts->segs_in = ti.tcpi_segs_in;
+	ts->data_segs_out = ti.tcpi_data_segs_out;
+	ts->bytes_acked = ti.tcpi_bytes_acked;
+	ts->pacing_rate = ti.tcpi_pacing_rate;
+	ts->delivery_rate = ti.tcpi_delivery_rate;
+	ts->busy_us = ti.tcpi_busy_time;
+	ts->rwnd_limited_us = ti.tcpi_rwnd_limited;
+	ts->sndbuf_limited_us = ti.tcpi_sndbuf_limited;
+	ts->syn_data = (ti.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+	}
+	return(0);
+#elif	defined(TCP_INFO)
+	{
+	struct tcp_info		ti;
+	socklen_t		optlen;
+
+	bzero(&ti, sizeof(ti));
+	optlen = sizeof(ti);
+	if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &ti, &optlen) < 0)
+		return(-1);
+
+	ts->rtt_us = ti.tcpi_rtt;
+	ts->rttvar_us = ti.tcpi_rttvar;
+	ts->snd_mss = ti.tcpi_snd_mss;
+	if (ti.tcpi_snd_mss != 0)	/* bytes, not segments */
+		ts->snd_cwnd = ti.tcpi_snd_cwnd / ti.tcpi_snd_mss;
+	ts->snd_wnd = ti.tcpi_snd_wnd;
+	ts->retrans = ti.tcpi_snd_rexmitpack;
+	}
+	return(0);
+#else
+	errno = ENOPROTOOPT;
+	return(-1);
+#endif
+}
+
+/*
+ * Like tcpinfo_get(), but first give the stack up to a second to send
+ * and get acknowledged what is still queued, so that the counts cover
+ * all of the data written.
+ */
+int
+tcpinfo_drain(int sockfd, struct tcpstat *ts)
+{
+	int	i;
+
+	for (i = 0; i < 1000; i++) {
+		if (tcpinfo_get(sockfd, ts) < 0)
+			return(-1);
+		if (ts->notsent_bytes == 0 && ts->unacked == 0)
+			break;
+		sleep_us(1000);
+	}
+	return(0);
+}
+
+/*
+ * With --fastopen, say whether the data written with the SYN was
+ * accepted, i.e. whether the server had given us a TFO cookie.
+ */
+void
+fastopen_report(int sockfd)
+{
+	struct tcpstat	ts;
+
+	if (tcpinfo_get(sockfd, &ts) < 0)
+		return;
+	fprintf(stderr, "TCP Fast Open: %s\n", ts.syn_data ?
+	    "data sent with the SYN" : "not used (no cookie yet?)");
+}
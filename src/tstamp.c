@@ -0,0 +1,143 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Timestamped payload, with --timestamp.  The source puts a sequence
+ * number and its wall-clock send time at the start of every write; the
+ * sink takes them out again and measures the delay from the source's
+ * write() to its own read, which includes any time the data spent
+ * queued in the sender's socket buffer.  The two clocks must agree,
+ * so this is meant for source and sink on the same host or with
+ * synchronized clocks.
+ *
+ * Over TCP the sink finds the headers by counting bytes:  it must be
+ * given the same -w as the source, so it knows where each write began.
+ */
+
+#include <time.h>
+#include "sock.h"
+
+static uint64_t	tx_seq;			/* next sequence number to send */
+
+static char	rx_hdr[TSTAMP_LEN];	/* header being reassembled */
+static int	rx_off;			/* offset within current record */
+static uint64_t	rx_n;			/* #delays measured */
+static uint64_t	rx_min, rx_max;		/* ns */
+static double	rx_sum;			/* ns */
+
+/*
+ * Wall-clock time in nanoseconds, for comparing with the peer.
+ */
+uint64_t
+realtime_ns(void)
+{
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+		err_sys("clock_gettime error");
+	return((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Big-endian 64-bit values, for anything written to the wire or a file.
+ */
+void
+put64(char *ptr, uint64_t val)
+{
+	int	i;
+
+	for (i = 7; i >= 0; i--) {
+		ptr[i] = val & 0xff;
+		val >>= 8;
+	}
+}
+
+uint64_t
+get64(const char *ptr)
+{
+	uint64_t	val;
+	int		i;
+
+	val = 0;
+	for (i = 0; i < 8; i++)
+		val = (val << 8) | (ptr[i] & 0xff);
+	return(val);
+}
+
+/*
+ * Put the next sequence number and the current time at the start of
+ * "buf", which must hold at least TSTAMP_LEN bytes.
+ */
+void
+tstamp_put(char *buf)
+{
+	put64(buf, tx_seq++);
+	put64(buf + 8, realtime_ns());
+}
+
+/*
+ * Decode a header:  returns its send time, and its sequence number
+ * through "seqp" (if not NULL).
+ */
+uint64_t
+tstamp_get(const char *buf, uint64_t *seqp)
+{
+	if (seqp != NULL)
+		*seqp = get64(buf);
+	return(get64(buf + 8));
+}
+
+/*
+ * Account for one measured delay, in nanoseconds.
+ */
+void
+tstamp_delay(int64_t delay)
+{
+	if (delay < 0)
+		delay = 0;	/* clocks not quite in step */
+	if (rx_n == 0 || (uint64_t) delay < rx_min)
+		rx_min = delay;
+	if ((uint64_t) delay > rx_max)
+		rx_max = delay;
+	rx_sum += delay;
+	rx_n++;
+}
+
+/*
+ * Sink side for a byte stream:  pass every byte read, in order.  The
+ * header at the start of each "reclen"-byte record may be split over
+ * several reads.
+ */
+void
+tstamp_stream(const char *buf, int n, int reclen)
+{
+	uint64_t	now;
+	int		len;
+
+	if (reclen < TSTAMP_LEN)
+		err_quit("--timestamp record length %d is less than %d",
+		    reclen, TSTAMP_LEN);	/* would never get past the header */
+	now = realtime_ns();
+	while (n > 0) {
+		if (rx_off < TSTAMP_LEN) {
+			len = min(n, TSTAMP_LEN - rx_off);
+			memcpy(rx_hdr + rx_off, buf, len);
+			if (rx_off + len == TSTAMP_LEN)
+				tstamp_delay(now - tstamp_get(rx_hdr, NULL));
+		} else {
+			len = min(n, reclen - rx_off);
+		}
+		buf += len;
+		n -= len;
+		if ( (rx_off += len) == reclen)
+			rx_off = 0;
+	}
+}
+
+void
+tstamp_report(void)
+{
+	if (rx_n == 0)
+		return;
+	fprintf(stderr, "delay: %llu samples, min %.3f ms, "
+	    "avg %.3f ms, max %.3f ms\n", (unsigned long long) rx_n,
+	    rx_min / 1e6, rx_sum / rx_n / 1e6, rx_max / 1e6);
+}
@@ -0,0 +1,313 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Transmit timestamps, with --txstamp, for the UDP and TCP sources.
+ * SO_TIMESTAMPING asks the kernel for a software timestamp when each
+ * write's data enters the packet scheduler (SCHED) and when the driver
+ * hands it to the device (SND).  They come back on the socket's error
+ * queue, which is drained without blocking after every write, so the
+ * send loop is never held up waiting for them.  From these and the time
+ * of each write we get the time spent in the sender's stack before the
+ * qdisc, and in the qdisc and driver queues.
+ *
+ * With SOF_TIMESTAMPING_OPT_ID each timestamp carries an id:  the
+ * datagram number for UDP, or the offset of the last byte of the write
+ * for TCP.  Writes not yet sent are kept in a ring; if more than TX_RING
+ * writes are outstanding the oldest are given up on.
+ *
+ * With --ackstamp n, every n'th write of the TCP source also asks for
+ * a timestamp when the peer acknowledges its last byte (TX_ACK), passed
+ * as a control message to that sendmsg() only, so that the cost is
+ * bounded by n.  That gives the write-to-ACK latency of a bulk transfer
+ * with nothing needed on the sink.  Sampled writes wait for their ACK
+ * timestamp in a ring of their own.
+ */
+
+#include "sock.h"
+#include <poll.h>
+#include <pthread.h>
+#if	defined(HAVE_LINUX_NET_TSTAMP_H) && defined(HAVE_LINUX_ERRQUEUE_H)
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif
+
+#if	defined(SO_TIMESTAMPING) && defined(HAVE_LINUX_NET_TSTAMP_H) && \
+	defined(HAVE_LINUX_ERRQUEUE_H)
+#define	HAVE_TXSTAMP
+#endif
+
+#define	TX_RING		4096		/* max writes awaiting timestamps */
+
+struct txent {
+	uint32_t	key;		/* timestamp id for this write */
+	uint64_t	t_write;	/* just before write(), ns */
+	uint64_t	t_sched;	/* entered the packet scheduler */
+};
+
+static struct txent	ring[TX_RING];
+static uint64_t		head, tail;	/* next entry to fill; oldest */
+static struct txent	ackring[TX_RING];	/* --ackstamp samples */
+static uint64_t		ackhead, acktail;
+static uint32_t		nextkey;	/* id of the next write */
+static uint64_t		nwrites, nstamps, ngiveup, ackgiveup;
+static struct hist	h_sched, h_snd, h_total, h_ack;
+static pthread_mutex_t	hist_lock = PTHREAD_MUTEX_INITIALIZER;	/* _live() */
+
+#ifdef	HAVE_TXSTAMP
+static int		recflags;	/* timestamps asked for every write */
+#endif
+
+void
+txstamp_init(int sockfd)
+{
+#ifdef	HAVE_TXSTAMP
+	int	option;
+
+	if (txstamp)
+		recflags = SOF_TIMESTAMPING_TX_SCHED |
+		    SOF_TIMESTAMPING_TX_SOFTWARE;
+	option = recflags | SOF_TIMESTAMPING_SOFTWARE |
+	    SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING,
+		       &option, sizeof(option)) < 0)
+		err_sys("SO_TIMESTAMPING setsockopt error");
+	hist_init(&h_sched);
+	hist_init(&h_snd);
+	hist_init(&h_total);
+	hist_init(&h_ack);
+#else
+	err_quit("SO_TIMESTAMPING transmit timestamps not supported by host");
+#endif
+}
+
+#ifdef	HAVE_TXSTAMP
+/*
+ * Account for one timestamp of type "type" for id "key", at "t".  TCP
+ * can append a write to a segment still queued from earlier writes, and
+ * then only the last of them gets a timestamp; it applies to them all,
+ * since their data left together.  So a timestamp is taken to cover
+ * every outstanding write up to and including "key".
+ */
+static void
+txstamp_one(int type, uint32_t key, uint64_t t)
+{
+	struct txent	*e;
+	uint64_t	 i, d;
+
+	nstamps++;
+	if (type == SCM_TSTAMP_ACK) {
+		for (i = acktail; i < ackhead; i++) {
+			e = &ackring[i % TX_RING];
+			if ((int32_t) (e->key - key) > 0)
+				break;		/* later write */
+			d = (t > e->t_write) ? t - e->t_write : 0;
+			hist_add(&h_ack, d);
+			acktail = i + 1;
+		}
+		return;
+	}
+
+	for (i = tail; i < head; i++) {
+		e = &ring[i % TX_RING];
+		if ((int32_t) (e->key - key) > 0)
+			break;			/* later write */
+		if (type == SCM_TSTAMP_SCHED) {
+			if (e->t_sched != 0)
+				continue;	/* already counted */
+			e->t_sched = t;
+			d = (t > e->t_write) ? t - e->t_write : 0;
+			hist_add(&h_sched, d);
+		} else if (type == SCM_TSTAMP_SND) {
+			if (e->t_sched != 0) {
+				d = (t > e->t_sched) ? t - e->t_sched : 0;
+				hist_add(&h_snd, d);
+			}
+			d = (t > e->t_write) ? t - e->t_write : 0;
+			hist_add(&h_total, d);
+			tail = i + 1;		/* done with this write */
+		}
+	}
+}
+#endif
+
+/*
+ * Read whatever timestamps are on the error queue.  With "waitms",
+ * keep waiting up to that long for the outstanding ones.
+ */
+static void
+txstamp_drain(int sockfd, int waitms)
+{
+#ifdef	HAVE_TXSTAMP
+	struct msghdr		 msg;
+	struct cmsghdr		*cmsg;
+	struct sock_extended_err *serr;
+	struct scm_timestamping	 tss;
+	struct pollfd		 pfd;
+	char			 control[512];
+	uint64_t		 t;
+
+	for ( ; ; ) {
+		bzero(&msg, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				err_sys("recvmsg error on error queue");
+			if (waitms == 0 || (tail == head && acktail == ackhead))
+				return;
+			pfd.fd = sockfd;
+			pfd.events = 0;		/* POLLERR is always polled */
+			if (poll(&pfd, 1, waitms) <= 0)
+				return;
+			continue;
+		}
+
+		t = 0;
+		serr = NULL;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+				t = (uint64_t) tss.ts[0].tv_sec * 1000000000 +
+				    tss.ts[0].tv_nsec;
+			} else if ((cmsg->cmsg_level == IPPROTO_IP &&
+			    cmsg->cmsg_type == IP_RECVERR) ||
+			    (cmsg->cmsg_level == IPPROTO_IPV6 &&
+			    cmsg->cmsg_type == IPV6_RECVERR)) {
+				serr = (struct sock_extended_err *)
+				    CMSG_DATA(cmsg);
+			}
+		}
+		if (serr != NULL && t != 0 && serr->ee_errno == ENOMSG &&
+		    serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+			pthread_mutex_lock(&hist_lock);
+			txstamp_one(serr->ee_info, serr->ee_data, t);
+			pthread_mutex_unlock(&hist_lock);
+		}
+	}
+#endif
+}
+
+/*
+ * Write "nbytes" of "vptr", noting the time and the id its timestamps
+ * will carry, then collect any timestamps that have come back.
+ */
+ssize_t
+txstamp_write(int sockfd, const void *vptr, size_t nbytes)
+{
+	struct txent	 e;
+	struct msghdr	 msg;
+	struct iovec	 iov;
+	ssize_t		 n;
+	int		 sample;
+#ifdef	HAVE_TXSTAMP
+	struct cmsghdr	*cmsg;
+	char		 control[CMSG_SPACE(sizeof(uint32_t))];
+	uint32_t	 flags;
+#endif
+
+	iov.iov_base = (void *) vptr;
+	iov.iov_len = nbytes;
+	bzero(&msg, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	sample = (ackstamp && nwrites % ackstamp == 0);
+#ifdef	HAVE_TXSTAMP
+	if (sample) {
+		/* replaces the socket's flags for this write only */
+		flags = recflags | SOF_TIMESTAMPING_TX_ACK;
+		bzero(control, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SO_TIMESTAMPING;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(flags));
+		memcpy(CMSG_DATA(cmsg), &flags, sizeof(flags));
+	}
+#endif
+
+	e.t_sched = 0;
+	e.t_write = realtime_ns();	/* kernel stamps are CLOCK_REALTIME */
+	n = sendmsg(sockfd, &msg, 0);
+	stats_txcall(nbytes, n);
+	if (n > 0) {
+		if (l4_prot == L4_PROT_UDP)
+			e.key = nextkey++;
+		else
+			e.key = (nextkey += n) - 1;	/* last byte */
+		nwrites++;
+
+		if (txstamp) {
+			if (head - tail == TX_RING) {
+				tail++;		/* give up on the oldest */
+				ngiveup++;
+			}
+			ring[head++ % TX_RING] = e;
+		}
+		if (sample) {
+			if (ackhead - acktail == TX_RING) {
+				acktail++;
+				ackgiveup++;
+			}
+			ackring[ackhead++ % TX_RING] = e;
+		}
+	}
+	txstamp_drain(sockfd, 0);
+	return(n);
+}
+
+/*
+ * The histograms so far, for SIGUSR1, from livestats' thread:  copied
+ * under the lock the source adds to them under, so they aren't torn.
+ * Stamps not yet drained from the error queue aren't in them.
+ */
+void
+txstamp_live(void)
+{
+	struct hist	total, ack;
+
+	hist_init(&total);
+	hist_init(&ack);
+	pthread_mutex_lock(&hist_lock);
+	hist_merge(&total, &h_total);
+	hist_merge(&ack, &h_ack);
+	pthread_mutex_unlock(&hist_lock);
+	if (txstamp)
+		hist_report(&total, "write to sent");
+	if (ackstamp)
+		hist_report(&ack, "write to ACK");
+	free(total.counts);
+	free(ack.counts);
+}
+
+void
+txstamp_report(int sockfd)
+{
+	txstamp_drain(sockfd, 1000);
+	if (txstamp) {
+		ngiveup += head - tail;		/* never got a SND stamp */
+		fprintf(stderr, "transmit timestamps:  %llu writes, "
+		    "%llu timestamps, %llu writes not stamped\n",
+		    (unsigned long long) nwrites,
+		    (unsigned long long) nstamps,
+		    (unsigned long long) ngiveup);
+		hist_report(&h_sched, "write to sched");
+		hist_report(&h_snd, "sched to sent");
+		hist_report(&h_total, "write to sent");
+		if (verbose)
+			hist_hgrm(&h_total, stderr);
+	}
+	if (ackstamp) {
+		ackgiveup += ackhead - acktail;	/* never got an ACK stamp */
+		fprintf(stderr, "ACK timestamps:  every %d writes, "
+		    "%llu not acknowledged\n", ackstamp,
+		    (unsigned long long) ackgiveup);
+		hist_report(&h_ack, "write to ACK");
+		if (verbose)
+			hist_hgrm(&h_ack, stderr);
+	}
+}
@@ -0,0 +1,353 @@
+/* -*- c-basic-offset: 8; -*- */
+/*
+ * Verbose logging off the data path.  With -v the source and sink loops
+ * print a line per read or write; straight to stderr that is a
+ * formatted write(2) each time, which costs more than the I/O being
+ * measured.  Instead, once vlog_start() has been called, vlog() formats
+ * the line into a ring of this thread's own and returns; a writer thread
+ * empties every ring each VLOG_PERIOD ms into a buffer of its own and
+ * writes that to stderr with one write(2).  Each ring has one producer
+ * (its thread) and one consumer (whoever holds "drain_lock"), so the
+ * producer side takes no lock:  it copies the line in and then
+ * publishes the new head with a release store, and the consumer
+ * publishes the new tail the same way.
+ *
+ * A ring holds bytes, not fixed-size slots, so short lines take little
+ * room; a line longer than VLOG_LINE is cut short, keeping its newline.
+ * When a thread exits its ring is kept for the next thread to start,
+ * so with --conns there are only as many rings as threads at once.
+ *
+ * If a ring is full its thread waits:  it empties the rings itself, as
+ * the writer would, and then queues the line, so that -v loses nothing
+ * (and costs what it did before, while it keeps up).  With --log-drop
+ * the line is dropped and counted instead.  To keep the rate down to
+ * begin with, --log-every n logs only every nth line of each thread,
+ * and --log-rate n at most n lines per second per thread; once a
+ * second the writer says how many were left out over the rate or
+ * dropped, and vlog_stop() gives the totals.
+ *
+ * err_ret() and err_msg() queue their messages here too, unsampled and
+ * never dropped, so that they stay in order with the rest.  The fatal
+ * ones, and anything else that writes to stderr directly (e.g. the
+ * end-of-run summary), call vlog_flush() first.  stderr itself stays
+ * unbuffered.
+ */
+
+#include "sock.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define	VLOG_RING	(64 * 1024)	/* bytes per thread, a power of 2 */
+#define	VLOG_LINE	256		/* longer vlog() lines are cut short */
+#define	VLOG_PERIOD	5		/* ms between writer passes */
+
+struct vring {
+	uint32_t	 head;		/* next byte to fill; producer's */
+	uint32_t	 tail;		/* next byte to write; consumer's */
+	int		 idle;		/* its thread has exited */
+	uint64_t	 nevents;	/* vlog() calls, for --log-every */
+	uint64_t	 window;	/* time_ns() when this second began */
+	uint64_t	 inwindow;	/* lines logged since, for --log-rate */
+	uint64_t	 overrate;	/* left out by --log-rate */
+	uint64_t	 dropped;	/* left out because the ring was full */
+	uint64_t	 lastover, lastdrop;	/* at the last summary */
+	struct vring	*next;		/* all of them, for the writer */
+	char		 buf[VLOG_RING];
+};
+
+static __thread struct vring	*myring;
+static struct vring		*rings;
+static pthread_key_t		 ring_key;	/* to give it up at exit */
+static pthread_mutex_t		 rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t		 drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static int			 running;
+static char			 outbuf[256 * 1024];	/* the writer's */
+static size_t			 outlen;
+
+#define	LOAD(x)		__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define	STORE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/*
+ * Thread exit:  the ring is free for the next thread; what's in it is
+ * still written out.
+ */
+static void
+vlog_release(void *arg)
+{
+	STORE(((struct vring *) arg)->idle, 1);
+}
+
+static struct vring *
+vlog_ring(void)
+{
+	struct vring	*r;
+	int		 idle;
+
+	if ( (r = myring) != NULL)
+		return(r);
+	pthread_mutex_lock(&rings_lock);
+	for (r = rings; r != NULL; r = r->next) {
+		idle = 1;
+		if (__atomic_compare_exchange_n(&r->idle, &idle, 0, 0,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;		/* an exited thread's */
+	}
+	if (r == NULL) {
+		if ( (r = calloc(1, sizeof(struct vring))) == NULL)
+			err_sys("calloc error for vlog ring");
+		r->next = rings;
+		STORE(rings, r);
+	}
+	pthread_mutex_unlock(&rings_lock);
+	r->nevents = r->window = r->inwindow = 0;
+	pthread_setspecific(ring_key, r);
+	return(myring = r);
+}
+
+/*
+ * Copy "len" bytes onto this thread's ring.  Returns -1 if there wasn't
+ * room.
+ */
+static int
+vlog_queue(struct vring *r, const char *s, size_t len)
+{
+	uint32_t	head, off;
+	size_t		n;
+
+	head = r->head;
+	if (len > VLOG_RING - (head - LOAD(r->tail)))
+		return(-1);
+	off = head % VLOG_RING;
+	n = min(len, VLOG_RING - off);
+	memcpy(r->buf + off, s, n);
+	memcpy(r->buf, s + n, len - n);		/* wrapped around */
+	STORE(r->head, head + len);
+	return(0);
+}
+
+/*
+ * printf() a line (ending in a newline) to stderr, from the data path:
+ * subject to --log-every and --log-rate, and queued rather than written
+ * once vlog_start() has been called.
+ */
+void
+vlog(const char *fmt, ...)
+{
+	struct vring	*r;
+	uint64_t	 now;
+	va_list		 ap;
+	char		 line[VLOG_LINE];
+	int		 n;
+
+	if (!running) {
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		return;
+	}
+	r = vlog_ring();
+	if (logevery > 1 && r->nevents++ % logevery != 0)
+		return;
+	if (lograte) {
+		now = time_ns();
+		if (now - r->window >= 1000000000) {
+			r->window = now;
+			r->inwindow = 0;
+		}
+		if (r->inwindow >= (uint64_t) lograte) {
+			__atomic_fetch_add(&r->overrate, 1,
+			    __ATOMIC_RELAXED);
+			return;
+		}
+		r->inwindow++;
+	}
+	va_start(ap, fmt);
+	n = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if (n >= VLOG_LINE) {
+		n = VLOG_LINE - 1;
+		line[n - 1] = '\n';	/* cut short, but still a line */
+	}
+	if (vlog_queue(r, line, n) == 0)
+		return;
+	if (logdrop) {
+		__atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	vlog_flush();			/* wait for room */
+	vlog_queue(r, line, n);
+}
+
+/*
+ * For err_doit():  queue the message "s" unsampled, if vlog_start() has
+ * been called.  Returns -1 if it wasn't, or if it won't fit even in an
+ * empty ring, so the caller writes it.
+ */
+int
+vlog_put(const char *s)
+{
+	struct vring	*r;
+	size_t		 len;
+
+	if (!running)
+		return(-1);
+	r = vlog_ring();
+	len = strlen(s);
+	if (vlog_queue(r, s, len) == 0)
+		return(0);
+	vlog_flush();			/* wait for room */
+	return(vlog_queue(r, s, len));
+}
+
+/*
+ * Write out what's in "outbuf".  Called with drain_lock held.
+ */
+static void
+vlog_write(void)
+{
+	size_t	off;
+	ssize_t	n;
+
+	for (off = 0; off < outlen; off += n)
+		if ( (n = write(STDERR_FILENO, outbuf + off,
+		    outlen - off)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			break;		/* nowhere to complain to */
+		}
+	outlen = 0;
+}
+
+/*
+ * Write out everything queued so far.  Called with drain_lock held.
+ */
+static void
+vlog_drain(void)
+{
+	struct vring	*r;
+	uint32_t	 head, tail;
+	size_t		 n;
+
+	for (r = LOAD(rings); r != NULL; r = r->next) {
+		head = LOAD(r->head);
+		for (tail = r->tail; tail != head; tail += n) {
+			n = min(head - tail, VLOG_RING - tail % VLOG_RING);
+			n = min(n, sizeof(outbuf) - outlen);
+			memcpy(outbuf + outlen, r->buf + tail % VLOG_RING, n);
+			if ( (outlen += n) == sizeof(outbuf))
+				vlog_write();
+		}
+		STORE(r->tail, tail);
+	}
+	vlog_write();
+}
+
+/*
+ * Once a second:  the lines left out over --log-rate, or dropped, since
+ * the last time.
+ */
+static void
+vlog_summary(void)
+{
+	struct vring	*r;
+	uint64_t	 over, drop, v;
+
+	over = drop = 0;
+	for (r = LOAD(rings); r != NULL; r = r->next) {
+		v = __atomic_load_n(&r->overrate, __ATOMIC_RELAXED);
+		over += v - r->lastover;
+		r->lastover = v;
+		v = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+		drop += v - r->lastdrop;
+		r->lastdrop = v;
+	}
+	if (over || drop)
+		fprintf(stderr, "vlog: %llu lines over --log-rate, "
+		    "%llu dropped (ring full) in the last second\n",
+		    (unsigned long long) over, (unsigned long long) drop);
+}
+
+static void *
+vlog_thread(void *arg)
+{
+	struct timespec	ts;
+	uint64_t	last;
+
+	(void) arg;
+	ts.tv_sec = 0;
+	ts.tv_nsec = VLOG_PERIOD * 1000000;
+	last = time_ns();
+	for ( ; ; ) {
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&drain_lock);
+		vlog_drain();
+		if (time_ns() - last >= 1000000000) {
+			vlog_summary();
+			last = time_ns();
+		}
+		pthread_mutex_unlock(&drain_lock);
+	}
+	return(NULL);
+}
+
+/*
+ * Write out everything queued so far, before writing to stderr directly.
+ */
+void
+vlog_flush(void)
+{
+	if (!running)
+		return;
+	pthread_mutex_lock(&drain_lock);
+	vlog_drain();
+	pthread_mutex_unlock(&drain_lock);
+}
+
+/*
+ * At exit:  the rest of the lines, and what was left out.
+ */
+static void
+vlog_stop(void)
+{
+	struct vring	*r;
+	uint64_t	 over, drop;
+
+	vlog_flush();
+	over = drop = 0;
+	for (r = LOAD(rings); r != NULL; r = r->next) {
+		over += __atomic_load_n(&r->overrate, __ATOMIC_RELAXED);
+		drop += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+	}
+	if (over || drop)
+		fprintf(stderr, "vlog: %llu lines over --log-rate, "
+		    "%llu dropped (ring full)\n", (unsigned long long) over,
+		    (unsigned long long) drop);
+}
+
+/*
+ * Start the writer thread; from here on vlog() and err_ret() queue.
+ */
+void
+vlog_start(void)
+{
+	pthread_t	tid;
+	int		rc;
+
+	if ( (rc = pthread_key_create(&ring_key, vlog_release)) != 0) {
+		errno = rc;
+		err_sys("pthread_key_create error");
+	}
+	if (atexit(vlog_stop) != 0)
+		err_quit("atexit error");
+	running = 1;
+	if ( (rc = pthread_create(&tid, NULL, vlog_thread, NULL)) != 0) {
+		errno = rc;
+		err_sys("pthread_create error");
+	}
+	pthread_detach(tid);
+}
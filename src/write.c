@@ -8,57 +8,204 @@
  * It is provided "as is" without express or implied warranty.
  */
 
+#include <limits.h>
 #include "sock.h"
 
-#ifndef	UIO_MAXIOV
-#define	UIO_MAXIOV	16	/* we assume this; may not be true? */
+#ifndef	IOV_MAX
+#ifdef	UIO_MAXIOV
+#define	IOV_MAX		UIO_MAXIOV
+#else
+#define	IOV_MAX		1024	/* POSIX minimum is 16; this is typical */
+#endif
 #endif
 
-ssize_t
-dowrite(int fd, const void *vptr, size_t nbytes)
+#define	IOV_DEFAULT	16	/* #chunks for -k and -V without --iov */
+
+static __thread struct iovec	*iov_buf;	/* malloc'ed, iov_max() + 1 */
+
+/*
+ * Most iovec{}s a single writev() or readv() will take.
+ */
+int
+iov_max(void)
+{
+#ifdef	_SC_IOV_MAX
+	long	n;
+
+	if ( (n = sysconf(_SC_IOV_MAX)) > 0)
+		return(n);
+#endif
+	return(IOV_MAX);
+}
+
+/*
+ * Number of iovec{}s the data of each write or read is split into,
+ * not counting a separate header (--iov-hdr).
+ */
+int
+iov_count(void)
+{
+	if (niovsizes > 0)
+		return(niovsizes);	/* --iov-sizes */
+	if (iovcnt > 0)
+		return(iovcnt);		/* --iov */
+	return(IOV_DEFAULT);
+}
+
+/*
+ * Describe the header "hdr" (if hdrlen is nonzero) followed by nbytes
+ * of "vptr" in iov[].  The data is split into iov_count() chunks, either
+ * of equal size or of the sizes given by --iov-sizes; the last chunk
+ * gets whatever is left over.  Returns the number of iov[] elements.
+ */
+int
+iov_fill(struct iovec *iov, const void *hdr, size_t hdrlen,
+    const void *vptr, size_t nbytes)
 {
-	struct iovec	iov[UIO_MAXIOV];
 	const char     *ptr;
-	int		chunksize, i, n, nleft, nwritten, ntotal;
+	int		cnt, chunksize, i, j, n, nleft;
 
-	if (chunkwrite == 0 && usewritev == 0)
-		return(write(fd, vptr, nbytes));		/* common case */
+	i = 0;
+	if (hdrlen != 0) {
+		iov[i].iov_base = (void *) hdr;
+		iov[i].iov_len = hdrlen;
+		i++;
+	}
 
 	/*
 	 * Figure out what sized chunks to write.
-	 * Try to use UIO_MAXIOV chunks.
 	 */
-
-	chunksize = nbytes / UIO_MAXIOV;
+	cnt = iov_count();
+	chunksize = nbytes / cnt;
 	if (chunksize <= 0)
 		chunksize = 1;
-	else if ((nbytes % UIO_MAXIOV) != 0)
+	else if ((nbytes % cnt) != 0)
 		chunksize++;
 
 	ptr = vptr;
 	nleft = nbytes;
-	for (i = 0; i < UIO_MAXIOV; i++) 
-	  {
-	    iov[i].iov_base = (void *) ptr;
-	    n = (nleft >= chunksize) ? chunksize : nleft;
-	    iov[i].iov_len = n;
-	    if (verbose)
-	      fprintf(stderr, "iov[%2d].iov_base = %p, iov[%2d].iov_len = %ld\n",
-		      i, iov[i].iov_base, i, (long) iov[i].iov_len);
+	for (j = 0; j < cnt && nleft > 0; i++, j++) {
+		n = (niovsizes > 0) ? iovsizes[j] : chunksize;
+		if (n > nleft || j == cnt - 1)
+			n = nleft;
+		iov[i].iov_base = (void *) ptr;
+		iov[i].iov_len = n;
 		ptr += n;
-		if ((nleft -= n) == 0)
-			break;
+		nleft -= n;
+	}
+
+	if (verbose) {
+		for (j = 0; j < i; j++)
+			vlog("iov[%2d].iov_base = %p, iov[%2d].iov_len = %ld\n",
+			    j, iov[j].iov_base, j, (long) iov[j].iov_len);
+	}
+
+	return(i);
+}
+
+/*
+ * Get this thread's iov[], big enough for any layout.
+ */
+struct iovec *
+iov_get(void)
+{
+	if (iov_buf == NULL) {
+		if ( (iov_buf = calloc(iov_max() + 1,
+		    sizeof(struct iovec))) == NULL)
+			err_sys("calloc error for iovec");
 	}
-	if (i == UIO_MAXIOV)
-		err_quit("i == UIO_MAXIOV");
+	return(iov_buf);
+}
 
-	if (usewritev)
-		return(writev(fd, iov, i+1));
-	else {
+/*
+ * Write the header "hdr" of hdrlen bytes (may be 0) followed by nbytes
+ * of "vptr", with write() or writev() as selected by -k, -V and --iov*.
+ * The header and data come from separate buffers, like an application
+ * sending a protocol header in front of its payload.
+ */
+ssize_t
+dowrite_hdr(int fd, const void *hdr, size_t hdrlen,
+    const void *vptr, size_t nbytes)
+{
+	struct iovec   *iov;
+	int		i, n, niov;
+	ssize_t		nwritten, ntotal;
+
+	if (chunkwrite == 0 && usewritev == 0) {
+		nwritten = write(fd, vptr, nbytes);		/* common case */
+		stats_txcall(nbytes, nwritten);
+		return(nwritten);
+	}
+
+	iov = iov_get();
+	niov = iov_fill(iov, hdr, hdrlen, vptr, nbytes);
+
+	if (usewritev) {
+		nwritten = writev(fd, iov, niov);
+		stats_txcall(hdrlen + nbytes, nwritten);
+		return(nwritten);
+	} else {
 		ntotal = 0;
-		for (n = 0; n <= i; n++) {
-			nwritten = write(fd, iov[n].iov_base, iov[n].iov_len);
-			if (nwritten != iov[n].iov_len)
+		for (i = 0; i < niov; i++) {
+			n = iov[i].iov_len;
+			nwritten = write(fd, iov[i].iov_base, n);
+			stats_txcall(n, nwritten);
+			if (nwritten != n)
+				return(-1);
+			ntotal += nwritten;
+		}
+		return(ntotal);
+	}
+}
+
+ssize_t
+dowrite(int fd, const void *vptr, size_t nbytes)
+{
+	return(dowrite_hdr(fd, NULL, 0, vptr, nbytes));
+}
+
+/*
+ * Like dowrite_hdr(), but with send() or sendmsg() so that "flags"
+ * (e.g. MSG_MORE) can be given.  With -k and no -V, every chunk but
+ * the last one also gets MSG_MORE, where the host has it.
+ */
+ssize_t
+dosend_hdr(int fd, const void *hdr, size_t hdrlen,
+    const void *vptr, size_t nbytes, int flags)
+{
+	struct msghdr	msg;
+	struct iovec   *iov;
+	int		i, n, niov, f;
+	ssize_t		nwritten, ntotal;
+
+	if (chunkwrite == 0 && usewritev == 0) {
+		nwritten = send(fd, vptr, nbytes, flags);	/* common case */
+		stats_txcall(nbytes, nwritten);
+		return(nwritten);
+	}
+
+	iov = iov_get();
+	niov = iov_fill(iov, hdr, hdrlen, vptr, nbytes);
+
+	if (usewritev) {
+		bzero(&msg, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = niov;
+		nwritten = sendmsg(fd, &msg, flags);
+		stats_txcall(hdrlen + nbytes, nwritten);
+		return(nwritten);
+	} else {
+		ntotal = 0;
+		for (i = 0; i < niov; i++) {
+			f = flags;
+#ifdef	MSG_MORE
+			if (i < niov - 1)
+				f |= MSG_MORE;
+#endif
+			n = iov[i].iov_len;
+			nwritten = send(fd, iov[i].iov_base, n, f);
+			stats_txcall(n, nwritten);
+			if (nwritten != n)
 				return(-1);
 			ntotal += nwritten;
 		}
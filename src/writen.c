@@ -12,7 +12,9 @@ writen(int fd, const void *vptr, size_t n)
 	ptr = vptr;
 	nleft = n;
 	while (nleft > 0) {
-		if ( (nwritten = write(fd, ptr, nleft)) <= 0) {
+		nwritten = write(fd, ptr, nleft);
+		stats_txcall(nleft, nwritten);		/* each retry too */
+		if (nwritten <= 0) {
 			if (errno == EINTR)
 				nwritten = 0;		/* and call write() again */
 			else